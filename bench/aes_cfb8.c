@@ -0,0 +1,61 @@
+/*
+ * AES-128-CFB8 throughput on a single core, for both directions and both
+ * the AES-NI and the portable implementations.
+ *
+ *      ./aes_cfb8.elf [buffer size]
+ */
+#include <net/aes_cfb8.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char* name, void (*func)(aes_cfb8_t*, uint8_t*, size_t), uint8_t* buffer, size_t size) {
+    static const uint8_t secret[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    aes_cfb8_t cipher;
+    aes_cfb8_init(&cipher, secret, secret);
+
+    // run for about half a second
+    size_t total = 0;
+    double start = now();
+    double elapsed = 0;
+    do {
+        for (int i = 0; i < 16; i++) {
+            func(&cipher, buffer, size);
+            total += size;
+        }
+        elapsed = now() - start;
+    } while (elapsed < 0.5);
+
+    printf("  %-8s %10.2f MB/s\n", name, total / elapsed / (1024 * 1024));
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = argc > 1 ? atoi(argv[1]) : 16384;
+    uint8_t* buffer = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        buffer[i] = rand();
+    }
+
+    printf("buffer size: %zu\n", size);
+
+    printf("aes-ni:\n");
+    aes_cfb8_use_aesni(1);
+    run("encrypt", aes_cfb8_encrypt, buffer, size);
+    run("decrypt", aes_cfb8_decrypt, buffer, size);
+
+    printf("portable:\n");
+    aes_cfb8_use_aesni(0);
+    run("encrypt", aes_cfb8_encrypt, buffer, size);
+    run("decrypt", aes_cfb8_decrypt, buffer, size);
+
+    free(buffer);
+    return EXIT_SUCCESS;
+}
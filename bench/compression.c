@@ -0,0 +1,204 @@
+/*
+ * Compression benchmark, compares the bytes on the wire and the cpu time spent
+ * for typical packet mixes, uncompressed and at different deflate levels.
+ *
+ *      ./compression.elf [threshold]
+ */
+#include <net/compression.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_PACKET_SIZE 65536
+
+typedef struct packet {
+    uint8_t* data;
+    size_t size;
+} packet_t;
+
+typedef struct packet_mix {
+    const char* name;
+    packet_t* packets;
+    size_t count;
+} packet_mix_t;
+
+static uint64_t m_random_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t random_u64() {
+    m_random_state ^= m_random_state << 13;
+    m_random_state ^= m_random_state >> 7;
+    m_random_state ^= m_random_state << 17;
+    return m_random_state;
+}
+
+static size_t varint_size(uint32_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static packet_t make_packet(size_t size) {
+    packet_t packet = { .data = malloc(size), .size = size };
+    return packet;
+}
+
+/**
+ * Something that looks like a chunk column: 16 paletted sections where most of
+ * the blocks are a handful of types in layers, and the heightmaps and light
+ */
+static packet_t make_chunk() {
+    packet_t packet = make_packet(40 * 1024);
+    uint8_t* out = packet.data;
+    for (int section = 0; section < 16; section++) {
+        // block count, bits per entry and a small palette
+        *out++ = 0x10; *out++ = 0x00; *out++ = 4; *out++ = 6;
+        for (int i = 0; i < 6; i++) {
+            *out++ = random_u64() % 128;
+        }
+
+        // 4096 entries of 4 bits, mostly stone with some ores
+        for (int i = 0; i < 4096 / 16; i++) {
+            uint64_t value = 0;
+            for (int j = 0; j < 16; j++) {
+                uint64_t block = (random_u64() % 16) == 0 ? random_u64() % 6 : (section < 4 ? 1 : 0);
+                value |= block << (j * 4);
+            }
+            memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+        }
+
+        // a single biome
+        *out++ = 0; *out++ = 1; *out++ = 0;
+    }
+    packet.size = out - packet.data;
+    return packet;
+}
+
+static packet_t make_movement() {
+    packet_t packet = make_packet(16);
+    for (int i = 0; i < 16; i++) {
+        packet.data[i] = random_u64();
+    }
+    packet.size = 10 + random_u64() % 6;
+    return packet;
+}
+
+static packet_t make_chat() {
+    static const char* messages[] = {
+        "hello",
+        "anyone want to trade diamonds for some iron?",
+        "gg",
+        "where is the nether portal again",
+    };
+    char text[512];
+    int len = snprintf(text, sizeof(text),
+                       "{\"translate\":\"chat.type.text\",\"with\":[{\"text\":\"Player%d\",\"clickEvent\":"
+                       "{\"action\":\"suggest_command\",\"value\":\"/tell Player%d \"}},{\"text\":\"%s\"}]}",
+                       (int)(random_u64() % 100), (int)(random_u64() % 100), messages[random_u64() % 4]);
+    packet_t packet = make_packet(len);
+    memcpy(packet.data, text, len);
+    return packet;
+}
+
+static packet_t make_entity_metadata() {
+    packet_t packet = make_packet(300);
+    for (int i = 0; i < 300; i++) {
+        packet.data[i] = (random_u64() % 4) == 0 ? random_u64() : 0;
+    }
+    packet.size = 50 + random_u64() % 250;
+    return packet;
+}
+
+static packet_mix_t make_mix(const char* name, int chunks, int movements, int chats, int metadata) {
+    packet_mix_t mix = { .name = name, .count = chunks + movements + chats + metadata };
+    mix.packets = malloc(mix.count * sizeof(packet_t));
+    size_t i = 0;
+    for (int j = 0; j < chunks; j++) mix.packets[i++] = make_chunk();
+    for (int j = 0; j < movements; j++) mix.packets[i++] = make_movement();
+    for (int j = 0; j < chats; j++) mix.packets[i++] = make_chat();
+    for (int j = 0; j < metadata; j++) mix.packets[i++] = make_entity_metadata();
+    return mix;
+}
+
+static double cpu_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_mix(packet_mix_t* mix, int threshold) {
+    static uint8_t compressed[MAX_PACKET_SIZE];
+    static uint8_t decompressed[MAX_PACKET_SIZE];
+
+    size_t raw_bytes = 0;
+    for (size_t i = 0; i < mix->count; i++) {
+        raw_bytes += varint_size(mix->packets[i].size) + mix->packets[i].size;
+    }
+
+    printf("%s: %zu packets\n", mix->name, mix->count);
+    printf("  level   wire bytes    ratio   deflate ms   inflate ms\n");
+    printf("  raw   %12zu   %6.3f   %10.2f   %10.2f\n", raw_bytes, 1.0, 0.0, 0.0);
+
+    for (int level = 1; level <= 9; level++) {
+        if (level != 1 && level != 4 && level != 6 && level != 9) {
+            continue;
+        }
+
+        size_t wire_bytes = 0;
+        double deflate_time = 0;
+        double inflate_time = 0;
+        for (size_t i = 0; i < mix->count; i++) {
+            packet_t* packet = &mix->packets[i];
+            if (packet->size < threshold) {
+                // sent as is, with a zero data length
+                wire_bytes += varint_size(packet->size + 1) + 1 + packet->size;
+                continue;
+            }
+
+            size_t compressed_size = 0;
+            double start = cpu_time();
+            compression_deflate(packet->data, packet->size, compressed, sizeof(compressed), level, &compressed_size);
+            deflate_time += cpu_time() - start;
+
+            start = cpu_time();
+            if (IS_ERROR(compression_inflate(compressed, compressed_size, decompressed, packet->size)) ||
+                memcmp(decompressed, packet->data, packet->size) != 0) {
+                printf("Round trip failed!\n");
+                exit(EXIT_FAILURE);
+            }
+            inflate_time += cpu_time() - start;
+
+            size_t inner = varint_size(packet->size) + compressed_size;
+            wire_bytes += varint_size(inner) + inner;
+        }
+
+        printf("  %-3d   %12zu   %6.3f   %10.2f   %10.2f\n", level, wire_bytes,
+               (double)wire_bytes / raw_bytes, deflate_time * 1000, inflate_time * 1000);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int threshold = argc > 1 ? atoi(argv[1]) : 256;
+
+    init_err_printf();
+
+    packet_mix_t mixes[] = {
+        make_mix("join (chunk heavy)", 400, 1000, 10, 200),
+        make_mix("steady play (movement heavy)", 20, 20000, 100, 2000),
+        make_mix("chat", 0, 100, 5000, 0),
+    };
+
+    printf("threshold: %d\n", threshold);
+    for (int i = 0; i < ARRAY_LEN(mixes); i++) {
+        run_mix(&mixes[i], threshold);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/*
+ * Framing a recv buffer full of small movement packets, the fetcher state
+ * machine the receiver goes through for every packet against the batch
+ * framer, decoding the lengths with the scalar and the SSE2 decoder.
+ *
+ *      ./framer.elf [buffer size]
+ */
+#include <net/framer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_FRAMES 64
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * The sizes of the movement packets a client sends every tick: position,
+ * position and rotation, rotation, on ground, and an occasional chat message
+ * that needs a two byte length
+ */
+static const int m_packet_sizes[] = { 26, 34, 10, 2, 34, 26, 34, 180 };
+
+/**
+ * Fill the buffer with packets, only the lengths matter for framing
+ */
+static size_t fill(uint8_t* buffer, size_t size) {
+    size_t offset = 0;
+    for (int i = 0; ; i++) {
+        int length = m_packet_sizes[i % (sizeof(m_packet_sizes) / sizeof(m_packet_sizes[0]))];
+        int header = length < 128 ? 1 : 2;
+        if (offset + header + length > size) {
+            break;
+        }
+        if (length < 128) {
+            buffer[offset] = length;
+        } else {
+            buffer[offset] = (length & 0x7F) | 0x80;
+            buffer[offset + 1] = length >> 7;
+        }
+        memset(buffer + offset + header, 0xAA, length);
+        offset += header + length;
+    }
+    return offset;
+}
+
+/**
+ * The state the receiver keeps between calls, this is what the fetcher
+ * state machine reads and writes for every byte
+ */
+typedef struct fetcher_state {
+    int line;
+    uint8_t varint_length;
+    int packet_length;
+} fetcher_state_t;
+
+#define FETCHER_BEGIN \
+    switch (state->line) { \
+        case 0:
+
+#define FETCHER_END \
+        break; \
+    }
+
+#define FETCHER_RETURN \
+    do { \
+        state->line = __LINE__; \
+        goto done; \
+        case __LINE__:; \
+    } while (0)
+
+/**
+ * What the receiver does without the framer, the fetcher state machine
+ * decodes the length a byte at a time for every packet
+ */
+static int frame_fetcher(const uint8_t* data, size_t len, frame_t* frames, int max_frames, size_t* consumed) {
+    static fetcher_state_t fetcher = { 0 };
+    fetcher_state_t* state = &fetcher;
+    const uint8_t* start = data;
+    int count = 0;
+
+    while (len > 0 && count < max_frames) {
+        FETCHER_BEGIN
+            state->varint_length = 0;
+            state->packet_length = 0;
+            while (true) {
+                if (len == 0) FETCHER_RETURN;
+                uint8_t current_byte = *data;
+                len--;
+                data++;
+
+                state->packet_length |= (current_byte & 0x7F) << (state->varint_length * 7);
+                state->varint_length++;
+                if ((current_byte & 0x80) == 0) {
+                    break;
+                }
+            }
+
+            // the buffer always ends at a packet boundary
+            frames[count].offset = data - start;
+            frames[count].length = state->packet_length;
+            count++;
+            data += state->packet_length;
+            len -= state->packet_length;
+
+            state->line = 0;
+        FETCHER_END
+    }
+
+done:
+    *consumed = data - start;
+    return count;
+}
+
+static int frame_batch(const uint8_t* data, size_t len, frame_t* frames, int max_frames, size_t* consumed) {
+    return framer_scan(data, len, 2097151, frames, max_frames, consumed);
+}
+
+static void run(const char* name, int (*func)(const uint8_t*, size_t, frame_t*, int, size_t*), uint8_t* buffer, size_t size) {
+    frame_t frames[MAX_FRAMES];
+    size_t packets = 0;
+    size_t bytes = 0;
+    size_t checksum = 0;
+
+    // run for about half a second
+    double start = now();
+    double elapsed = 0;
+    do {
+        for (int i = 0; i < 256; i++) {
+            size_t offset = 0;
+            while (offset < size) {
+                size_t consumed = 0;
+                int count = func(buffer + offset, size - offset, frames, MAX_FRAMES, &consumed);
+                for (int j = 0; j < count; j++) {
+                    checksum += frames[j].length;
+                }
+                packets += count;
+                offset += consumed;
+                bytes += consumed;
+            }
+        }
+        elapsed = now() - start;
+    } while (elapsed < 0.5);
+
+    // the checksum keeps the frames from being optimized away
+    printf("  %-10s %8.2f Mpackets/s %10.2f MB/s (checksum %zu)\n", name,
+           packets / elapsed / 1e6, bytes / elapsed / (1024 * 1024), checksum);
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = argc > 1 ? atoi(argv[1]) : 4096;
+    uint8_t* buffer = malloc(size);
+    size = fill(buffer, size);
+
+    printf("buffer size: %zu\n", size);
+    run("fetcher", frame_fetcher, buffer, size);
+    framer_use_simd(false);
+    run("scalar", frame_batch, buffer, size);
+    framer_use_simd(true);
+    run("sse2", frame_batch, buffer, size);
+
+    free(buffer);
+    return EXIT_SUCCESS;
+}
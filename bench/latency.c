@@ -0,0 +1,157 @@
+/*
+ * Loopback round trip benchmark, connects to the server in the status phase and
+ * measures the time between sending a ping and getting the pong back.
+ *
+ * Run the server normally and with --low-latency and compare:
+ *      ./server.elf [--low-latency] &
+ *      ./latency.elf [host] [port] [pings]
+ */
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+static size_t write_varint(uint8_t* out, uint32_t value) {
+    size_t size = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            byte |= 0x80;
+        }
+        out[size++] = byte;
+    } while (value != 0);
+    return size;
+}
+
+static bool send_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t got = recv(fd, data, size, 0);
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char* argv[]) {
+    const char* host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 25565;
+    int pings = argc > 3 ? atoi(argv[3]) : 100000;
+    int warmup = pings / 10;
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+    };
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "The host must be an ipv4 address (got %s)\n", host);
+        return EXIT_FAILURE;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        return EXIT_FAILURE;
+    }
+
+    // handshake into the status phase, the id, version, host length, port
+    // and next state take at most 16 bytes next to the host
+    uint8_t packet[64];
+    uint8_t frame[sizeof(packet) + 5];
+    size_t host_len = strnlen(host, sizeof(packet));
+    if (host_len > sizeof(packet) - 16) {
+        fprintf(stderr, "The host is too long\n");
+        return EXIT_FAILURE;
+    }
+    size_t size = 0;
+    packet[size++] = 0x00;
+    size += write_varint(packet + size, 757);
+    size += write_varint(packet + size, host_len);
+    memcpy(packet + size, host, host_len);
+    size += host_len;
+    packet[size++] = port >> 8;
+    packet[size++] = port & 0xFF;
+    size += write_varint(packet + size, 1);
+    size_t frame_size = write_varint(frame, size);
+    memcpy(frame + frame_size, packet, size);
+    if (!send_all(fd, frame, frame_size + size)) {
+        perror("send");
+        return EXIT_FAILURE;
+    }
+
+    // ping packet, length + id + long payload
+    uint8_t ping[10] = { 9, 0x01 };
+    uint8_t pong[10];
+
+    uint64_t* samples = malloc(pings * sizeof(uint64_t));
+    for (int i = 0; i < warmup + pings; i++) {
+        memcpy(ping + 2, &i, sizeof(i));
+
+        uint64_t start = now_ns();
+        if (!send_all(fd, ping, sizeof(ping)) || !recv_all(fd, pong, sizeof(pong))) {
+            perror("ping");
+            return EXIT_FAILURE;
+        }
+        uint64_t end = now_ns();
+
+        if (memcmp(ping, pong, sizeof(ping)) != 0) {
+            fprintf(stderr, "Got invalid pong\n");
+            return EXIT_FAILURE;
+        }
+
+        if (i >= warmup) {
+            samples[i - warmup] = end - start;
+        }
+    }
+
+    qsort(samples, pings, sizeof(uint64_t), compare_u64);
+    printf("pings: %d\n", pings);
+    printf("p50:   %.2fus\n", samples[pings / 2] / 1000.0);
+    printf("p99:   %.2fus\n", samples[(size_t)(pings * 0.99)] / 1000.0);
+    printf("p99.9: %.2fus\n", samples[(size_t)(pings * 0.999)] / 1000.0);
+    printf("max:   %.2fus\n", samples[pings - 1] / 1000.0);
+
+    free(samples);
+    close(fd);
+    return EXIT_SUCCESS;
+}
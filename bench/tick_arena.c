@@ -0,0 +1,151 @@
+/*
+ * Going over the packets of a tick in the order the game tick handles them,
+ * which is not the order they were allocated in, with the arenas mapped
+ * with normal pages against huge pages. The dTLB misses are counted with
+ * perf if it is allowed (see /proc/sys/kernel/perf_event_paranoid).
+ *
+ *      ./tick_arena.elf [arena megabytes]
+ */
+#include <minecraft/tick_arena.h>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t m_seed = 0x9E3779B97F4A7C15ull;
+
+static uint64_t random_u64() {
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 7;
+    m_seed ^= m_seed << 17;
+    return m_seed;
+}
+
+/**
+ * Open a counter for the dTLB load misses of this process, -1 if perf is not allowed
+ */
+static int open_dtlb_counter() {
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HW_CACHE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Packets the size of what a client sends in a tick, mostly small
+ * movement packets with the occasional larger one
+ */
+static size_t packet_size() {
+    size_t size = 32 + random_u64() % 64;
+    if (random_u64() % 16 == 0) {
+        size += random_u64() % 1024;
+    }
+    return size;
+}
+
+static void run(bool huge_pages, size_t arena_size) {
+    err_t err = init_tick_arenas(huge_pages);
+    if (IS_ERROR(err)) {
+        printf("failed to map the arenas\n");
+        exit(EXIT_FAILURE);
+    }
+    tick_arena_t* arena = switch_tick_arenas();
+
+    // bump allocate the packets of the tick
+    size_t capacity = arena_size / 32;
+    uint8_t** packets = malloc(capacity * sizeof(uint8_t*));
+    size_t count = 0;
+    while (arena->current_offset + 2048 < arena_size) {
+        size_t size = packet_size();
+        uint8_t* packet = tick_arena_alloc_unlocked(arena, size);
+        memset(packet, (uint8_t)count, size);
+        packets[count++] = packet;
+    }
+
+    // the game tick handles them by entity and not by arrival
+    for (size_t i = count - 1; i > 0; i--) {
+        size_t j = random_u64() % (i + 1);
+        uint8_t* temp = packets[i];
+        packets[i] = packets[j];
+        packets[j] = temp;
+    }
+
+    int counter = open_dtlb_counter();
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    size_t checksum = 0;
+    size_t total = 0;
+    double start = now();
+    double elapsed = 0;
+    do {
+        for (size_t i = 0; i < count; i++) {
+            checksum += packets[i][0] + packets[i][24];
+        }
+        total += count;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+
+    uint64_t misses = 0;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+            close(counter);
+            counter = -1;
+        }
+    }
+
+    printf("%-6s %8.2f Mpackets/s", huge_pages ? "huge" : "4k", total / elapsed / 1e6);
+    if (counter >= 0) {
+        printf(" %6.3f dTLB misses/packet\n", (double)misses / total);
+        close(counter);
+    } else {
+        printf(" dTLB misses n/a\n");
+    }
+
+    // the checksum keeps the loop from being optimized away
+    printf("       (%zu packets, checksum %zu)\n", count, checksum);
+    free(packets);
+}
+
+int main(int argc, char* argv[]) {
+    size_t arena_size = (argc > 1 ? atoi(argv[1]) : 512) * SIZE_1MB;
+    if (arena_size == 0 || arena_size > SIZE_1GB) {
+        printf("the arena size must be between 1 and 1024 megabytes\n");
+        return EXIT_FAILURE;
+    }
+
+    // the arenas can only be set up once, so every mode gets a process of its own
+    bool modes[] = { false, true };
+    for (int i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(modes[i], arena_size);
+            return EXIT_SUCCESS;
+        }
+        waitpid(pid, NULL, 0);
+    }
+
+    return EXIT_SUCCESS;
+}
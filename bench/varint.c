@@ -0,0 +1,219 @@
+/*
+ * Encoding and decoding streams of varints, the byte at a time codec the
+ * protocol used to have against the current one. Build with -mbmi2 (or
+ * -march=native) to get the pext version of the current decoder.
+ *
+ *      ./varint.elf [count]
+ */
+#include <minecraft/protocol/protocol.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t m_seed = 0x9E3779B97F4A7C15ull;
+
+static uint64_t random_u64() {
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 7;
+    m_seed ^= m_seed << 17;
+    return m_seed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The old codec, with the value cleared first since it ORs into it
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int old_read_varint(uint8_t* buffer, int size, int32_t* value) {
+    int original_size = size;
+    int shift = 0;
+    *value = 0;
+    while (true) {
+        if (size <= 0) return -1;
+        uint8_t b = *buffer;
+        buffer++;
+        size--;
+        *value |= ((b & 0x7F) << shift);
+        if (!(b & 0x80)) {
+            break;
+        }
+        shift += 7;
+        if (shift >= 32) return -1;
+    }
+    return original_size - size;
+}
+
+static int old_write_varlong(uint8_t* buffer, int size, int64_t value) {
+    int original_size = size;
+
+    do {
+        uint8_t current_byte = value & 0x7f;
+        value >>= 7;
+
+        if (value) {
+            current_byte |= 0x80;
+        }
+
+        *buffer = current_byte;
+        buffer++;
+        size--;
+    } while (value);
+
+    return original_size - size;
+}
+
+static int old_write_varint(uint8_t* buffer, int size, int32_t value) {
+    return old_write_varlong(buffer, size, value);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Value distributions
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Packet ids, always a single byte
+ */
+static int32_t packet_id() {
+    return random_u64() % 0x70;
+}
+
+/**
+ * Packet and string lengths, mostly small with a long tail up to the max packet size
+ */
+static int32_t length() {
+    int bits = 1 + random_u64() % 21;
+    return random_u64() & ((1u << bits) - 1);
+}
+
+/**
+ * Entity ids, counters that are a few hundred thousand in on a running server
+ */
+static int32_t entity_id() {
+    return 100000 + random_u64() % 400000;
+}
+
+/**
+ * Any 32 bit value, half of them are negative so they take 5 bytes
+ */
+static int32_t any() {
+    return (int32_t)random_u64();
+}
+
+typedef struct distribution {
+    const char* name;
+    int32_t (*generate)();
+    bool has_negative;
+} distribution_t;
+
+static distribution_t m_distributions[] = {
+    { "packet id", packet_id, false },
+    { "length", length, false },
+    { "entity id", entity_id, false },
+    { "any", any, true },
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Runs
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef int (*write_func_t)(uint8_t* buffer, int size, int32_t value);
+typedef int (*read_func_t)(uint8_t* buffer, int size, int32_t* value);
+
+static double run_write(write_func_t func, const int32_t* values, int count, uint8_t* buffer, int size, size_t* checksum) {
+    size_t total = 0;
+    double start = now();
+    double elapsed = 0;
+    do {
+        uint8_t* out = buffer;
+        int left = size;
+        for (int i = 0; i < count; i++) {
+            int written = func(out, left, values[i]);
+            out += written;
+            left -= written;
+        }
+        *checksum += out - buffer;
+        total += count;
+        elapsed = now() - start;
+    } while (elapsed < 0.3);
+    return total / elapsed / 1e6;
+}
+
+static double run_read(read_func_t func, int count, uint8_t* buffer, int size, size_t* checksum) {
+    size_t total = 0;
+    double start = now();
+    double elapsed = 0;
+    do {
+        uint8_t* in = buffer;
+        int left = size;
+        for (int i = 0; i < count; i++) {
+            int32_t value;
+            int read = func(in, left, &value);
+            in += read;
+            left -= read;
+            *checksum += value;
+        }
+        total += count;
+        elapsed = now() - start;
+    } while (elapsed < 0.3);
+    return total / elapsed / 1e6;
+}
+
+static void run_size(const int32_t* values, int count, size_t* checksum) {
+    size_t total = 0;
+    double start = now();
+    double elapsed = 0;
+    do {
+        for (int i = 0; i < count; i++) {
+            *checksum += protocol_varint_size(values[i]);
+        }
+        total += count;
+        elapsed = now() - start;
+    } while (elapsed < 0.3);
+    printf("  %-6s %-6s %8.2f Mvarints/s\n", "size", "new", total / elapsed / 1e6);
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 4096;
+    int32_t* values = malloc(count * sizeof(int32_t));
+    int size = count * 5 + 8;
+    uint8_t* buffer = malloc(size);
+
+#ifdef __BMI2__
+    printf("codec: bmi2\n");
+#else
+    printf("codec: portable\n");
+#endif
+
+    for (int d = 0; d < sizeof(m_distributions) / sizeof(m_distributions[0]); d++) {
+        distribution_t* distribution = &m_distributions[d];
+        for (int i = 0; i < count; i++) {
+            values[i] = distribution->generate();
+        }
+
+        size_t checksum = 0;
+        printf("%s:\n", distribution->name);
+
+        // the old codec sign extends negative values and never ends the loop
+        if (!distribution->has_negative) {
+            printf("  %-6s %-6s %8.2f Mvarints/s\n", "write", "old", run_write(old_write_varint, values, count, buffer, size, &checksum));
+            printf("  %-6s %-6s %8.2f Mvarints/s\n", "read", "old", run_read(old_read_varint, count, buffer, size, &checksum));
+        }
+        printf("  %-6s %-6s %8.2f Mvarints/s\n", "write", "new", run_write(protocol_write_varint, values, count, buffer, size, &checksum));
+        printf("  %-6s %-6s %8.2f Mvarints/s\n", "read", "new", run_read(protocol_read_varint, count, buffer, size, &checksum));
+        run_size(values, count, &checksum);
+
+        // the checksum keeps the results from being optimized away
+        printf("  (checksum %zu)\n", checksum);
+    }
+
+    free(values);
+    free(buffer);
+    return EXIT_SUCCESS;
+}
@@ -338,6 +338,13 @@ class ProtoDefSwitch(ProtoDefBase):
         if self.is_abstract_instance():
             return self._name
         else:
+            # unnamed cases are read right into the switch field, so when
+            # they all have the same type the field is just that type
+            members = [(name, typ) for name, typ, value in self._fields if not isinstance(typ, ProtoDefVoid)]
+            definitions = {typ.gen_definition_code() for name, typ in members}
+            if len(definitions) == 1 and all(name == '' for name, typ in members):
+                return definitions.pop()
+
             c = 'union {'
             for field in self._fields:
                 name, typ, value = field
@@ -471,15 +478,15 @@ class ProtoDefArray(ProtoDefBase):
         else:
             # This is a rest data, it goes all the way to the end
             # of the packet unconditionally
-            c += f'{length_access} = size / sizeof({self._element_type.get_size()});'
-            c += f'size -= {length_access};'
+            c += f'{length_access} = size / {self._element_type.get_size()};'
+            c += f'size -= {length_access} * {self._element_type.get_size()};'
 
         if self._count_type is not None:
             if not self._element_type.is_variable():
                 c += f'if ({length_access} * {self._element_type.get_size()} > size) return -1;'
                 c += f'size -= {length_access} * {self._element_type.get_size()};'
 
-        c += f'{elements_access} = tick_arena_alloc_unlocked(arena, {length_access} * sizeof(*{elements_access}));'
+        c += f'{elements_access} = tick_arena_alloc(arena, {length_access} * sizeof(*{elements_access}));'
         c += f'if ({elements_access} == NULL) return -1;'
         i = 'i' + str(random.randint(0, 1000))
         c += f'for (int {i} = 0; {i} < {length_access}; {i}++)'
@@ -951,7 +958,24 @@ def generate_base_types(protocol_types):
     return code, header
 
 
+# Phases that are answered right on the reactor and never need to allocate
+# anything, their packets are processed without getting a tick arena
+ARENALESS_PHASES = {
+    'status',
+}
+
+
+# Phases that are processed by the game tick instead of the reactor, their
+# handlers get the handle of the client and the arena of the current tick
+GAME_PHASES = {
+    'play',
+}
+
+
 def generate_packet_parser(protocol, phase, code, header):
+    use_arena = phase not in ARENALESS_PHASES
+    on_game = phase in GAME_PHASES
+    client_type = 'client_handle_t' if on_game else 'client_t*'
     packets = protocol[phase]['toServer']['types']
     for packet_name in packets:
         if packet_name == 'packet':
@@ -968,29 +992,51 @@ def generate_packet_parser(protocol, phase, code, header):
         code.append(c.strip())
         header.append(h.strip())
 
-        header.append(f'err_t process_{name}(tick_arena_t* arena, client_t* client, {name}_t* packet);')
+        if use_arena:
+            header.append(f'err_t process_{name}(tick_arena_t* arena, {client_type} client, {name}_t* packet);')
+        else:
+            header.append(f'err_t process_{name}({client_type} client, {name}_t* packet);')
 
         c = ''
-        c += f'err_t dispatch_{name}(client_t* client, uint8_t* data, int size)'
+        if on_game:
+            c += f'static err_t dispatch_{name}(tick_arena_t* arena, client_handle_t client, uint8_t* data, int size)'
+        else:
+            c += f'err_t dispatch_{name}(client_t* client, uint8_t* data, int size)'
         c += '{'
         c += 'err_t err = NO_ERROR;'
         c += f'{name}_t packet = {{ 0 }};'
-        c += 'tick_arena_t* arena = get_tick_arena();'
+        if on_game:
+            # the game tick owns the arena, nothing to get or return
+            pass
+        elif use_arena:
+            c += 'tick_arena_t* arena = get_tick_arena();'
+        else:
+            c += 'tick_arena_t* arena = NULL;'
         if typ.is_variable():
             c += f'int read_size = protocol_read_{name}(arena, data, size, &packet);'
             c += f'CHECK_ERROR(read_size == size, ERROR_PROTOCOL, "Got a packet that is bigger than expected!");'
         else:
             c += f'packet = protocol_read_{name}(data, size);'
         c += '\n'
-        c += f'CHECK_AND_RETHROW(process_{name}(arena, client, &packet));'
+        if use_arena:
+            c += f'CHECK_AND_RETHROW(process_{name}(arena, client, &packet));'
+        else:
+            c += f'CHECK_AND_RETHROW(process_{name}(client, &packet));'
         c += '\n'
         c += 'cleanup:\n'
-        c += 'return_tick_arena(arena);'
+        if use_arena and not on_game:
+            c += 'return_tick_arena(arena);'
         c += 'return err;'
         c += '}'
         code.append(beautify(c))
 
 
+def generate_send_policy(phase: str, packet_name: str, packet_id: str):
+    # only play packets can be dropped or merged (particles, sounds, entity
+    # teleports and the like), and the play senders are not generated yet
+    return 'SEND_NORMAL, 0'
+
+
 def generate_packet_sender(protocol, phase, code, header):
     packets = protocol[phase]['toClient']['types']
     mappings = protocol[phase]['toClient']['types']['packet'][1][0]['type'][1]['mappings']
@@ -1006,29 +1052,96 @@ def generate_packet_sender(protocol, phase, code, header):
         header.append(h.strip())
 
         header.append(f'err_t send_{name}(client_t* client, {name}_t* packet);')
+        header.append(f'err_t broadcast_{name}(client_t** clients, int count, {name}_t* packet);')
+        header.append(f'err_t queue_broadcast_{name}(client_handle_t* clients, int count, {name}_t* packet);')
+
+        # encodes the packet into a new send buffer
+        encode = ''
+        encode += 'uint8_t* buffer = buffer_pool_get_protocol_send();'
+        encode += 'CHECK_ERRNO(buffer != NULL);'
+        encode += 'uint8_t* data = buffer + SERVER_SEND_HEADROOM;'
+        encode += 'int size = g_server_config.max_send_packet_size - SERVER_SEND_HEADROOM;'
+        encode += '\n'
+        encode += f'int pid_len = protocol_write_varint(data, size, {packet_id});'
+        encode += f'CHECK_ERROR(pid_len >= 0, ERROR_PROTOCOL, "Not enough space for packet!");'
+        encode += '\n'
+        if typ.is_variable():
+            encode += f'int packet_len = protocol_write_{name}(data + pid_len, size - pid_len, packet);'
+            encode += f'CHECK_ERROR(packet_len >= 0, ERROR_PROTOCOL, "Not enough space for packet!");'
+        else:
+            encode += f'CHECK_ERROR(size - pid_len >= {typ.get_size()}, ERROR_PROTOCOL, "Not enough space for packet!");'
+            encode += f'protocol_write_{name}(data + pid_len, packet);'
+            encode += f'int packet_len = {typ.get_size()};'
+        encode += '\n'
+        encode += '// the server owns the buffer from here on, even if sending fails\n'
+        encode += 'uint8_t* packet_buffer = buffer;'
+        encode += 'buffer = NULL;'
+
+        policy = generate_send_policy(phase, packet_name, packet_id)
 
         c = ''
         c += f'err_t send_{name}(client_t* client, {name}_t* packet)'
         c += '{'
         c += 'err_t err = NO_ERROR;'
-        c += 'uint8_t* buffer = buffer_pool_get_protocol_send();'
+        c += encode
+        c += f'CHECK_AND_RETHROW(server_send_packet(client, packet_buffer, pid_len + packet_len, {policy}));'
         c += '\n'
-        c += f'int pid_len = protocol_write_varint(buffer, g_server_config.max_send_packet_size, {packet_id});'
-        c += f'CHECK_ERROR(pid_len >= 0, ERROR_PROTOCOL, "Not enough space for packet!");'
+        c += 'cleanup:\n'
+        c += 'if (IS_ERROR(err) && buffer != NULL) {buffer_pool_return_protocol_send(buffer);}\n'
+        c += 'return err;'
+        c += '}'
+        code.append(beautify(c))
+
+        # the broadcast encodes the packet once, and all the clients
+        # reference the same frame (one per reactor with compression)
+        c = ''
+        c += f'err_t broadcast_{name}(client_t** clients, int count, {name}_t* packet)'
+        c += '{'
+        c += 'err_t err = NO_ERROR;'
+        c += 'server_broadcast_t* broadcast = NULL;'
+        c += encode
+        c += 'CHECK_AND_RETHROW(server_broadcast_create(packet_buffer, pid_len + packet_len, &broadcast));'
+        c += 'for (int i = 0; i < count; i++) {'
+        c += f'err = server_broadcast_send(clients[i], broadcast, {policy});'
         c += '\n'
-        if typ.is_variable():
-            c += f'int packet_len = protocol_write_{name}(buffer + pid_len, g_server_config.max_send_packet_size - pid_len, packet);'
-            c += f'CHECK_ERROR(packet_len >= 0, ERROR_PROTOCOL, "Not enough space for packet!");'
-            c += '\n'
-            c += f'CHECK_AND_RETHROW(server_send_packet(client, buffer, pid_len + packet_len));'
-        else:
-            c += f'CHECK_ERROR(g_server_config.max_send_packet_size - pid_len >= {typ.get_size()}, ERROR_PROTOCOL, "Not enough space for packet!");'
-            c += f'protocol_write_{name}(buffer + pid_len, packet);'
-            c += '\n'
-            c += f'CHECK_AND_RETHROW(server_send_packet(client, buffer, {typ.get_size()}));'
+        c += '// a single client failing only drops that client, the rest still get the packet\n'
+        c += 'if (err == ERROR_PROTOCOL) {'
+        c += f'WARN("Failed to broadcast {name} to client %d/%d (slot %d), disconnecting it", i + 1, count, clients[i]->socket);'
+        c += 'server_disconnect(clients[i]);'
+        c += 'err = NO_ERROR;'
+        c += '}\n'
+        c += 'CHECK_AND_RETHROW(err);'
+        c += '}'
         c += '\n'
         c += 'cleanup:\n'
-        c += 'if (IS_ERROR(err)) {buffer_pool_return_protocol_send(buffer);}\n'
+        c += 'if (broadcast != NULL) {server_broadcast_release(broadcast);}\n'
+        c += 'if (IS_ERROR(err) && buffer != NULL) {buffer_pool_return_protocol_send(buffer);}\n'
+        c += 'return err;'
+        c += '}'
+        code.append(beautify(c))
+
+        # the same from the game tick, the reactor of every client sends it
+        c = ''
+        c += f'err_t queue_broadcast_{name}(client_handle_t* clients, int count, {name}_t* packet)'
+        c += '{'
+        c += 'err_t err = NO_ERROR;'
+        c += 'server_broadcast_t* broadcast = NULL;'
+        c += encode
+        c += 'CHECK_AND_RETHROW(server_broadcast_create(packet_buffer, pid_len + packet_len, &broadcast));'
+        c += 'for (int i = 0; i < count; i++) {'
+        c += f'err = server_queue_broadcast(clients[i], broadcast, {policy});'
+        c += '\n'
+        c += '// the reactor of the client is falling behind, it is not getting the packet\n'
+        c += 'if (err == ERROR_PROTOCOL) {'
+        c += 'server_queue_disconnect(clients[i]);'
+        c += 'err = NO_ERROR;'
+        c += '}\n'
+        c += 'CHECK_AND_RETHROW(err);'
+        c += '}'
+        c += '\n'
+        c += 'cleanup:\n'
+        c += 'if (broadcast != NULL) {server_broadcast_release(broadcast);}\n'
+        c += 'if (IS_ERROR(err) && buffer != NULL) {buffer_pool_return_protocol_send(buffer);}\n'
         c += 'return err;'
         c += '}'
         code.append(beautify(c))
@@ -1038,7 +1151,7 @@ def generate_dispatcher(protocol, code, header):
     generate_packet_parser(protocol, 'handshaking', code, header)
     generate_packet_parser(protocol, 'status', code, header)
     generate_packet_parser(protocol, 'login', code, header)
-    # generate_packet_parser(protocol, 'play', code, header)
+    generate_packet_parser(protocol, 'play', code, header)
 
     generate_packet_sender(protocol, 'handshaking', code, header)
     generate_packet_sender(protocol, 'status', code, header)
@@ -1071,7 +1184,26 @@ def generate_dispatcher(protocol, code, header):
         c += 'default: CHECK_FAIL_ERROR(ERROR_PROTOCOL, "Got unknown packet id: %d", packet_id);'
         c += '}\n'
         c += '} break;'
-    c += 'default: CHECK_FAIL("Got to invalid state: %d", client->state);'
+    # play packets touch the world, so they are handed to the game tick
+    c += 'case PROTOCOL_PLAY: {CHECK_AND_RETHROW(server_queue_packet(client, packet_id, data, size));} break;'
+    c += 'default: CHECK_FAIL_ERROR(ERROR_PROTOCOL, "Got packet in unhandled state: %d", client->state);'
+    c += '}\n'
+    c += 'cleanup:\n'
+    c += 'return err;'
+    c += '}'
+
+    code.append(beautify(c))
+
+    # the play packets the reactors queued are parsed by the game tick
+    mapper = protocol['play']['toServer']['types']['packet'][1][0]['type'][1]['mappings']
+    c = ''
+    c += 'err_t dispatch_play_packet(tick_arena_t* arena, client_handle_t client, int32_t packet_id, uint8_t* data, int size) {'
+    c += 'err_t err = NO_ERROR;'
+    c += '\n'
+    c += 'switch (packet_id) {'
+    for id in mapper:
+        c += f'case {id}: {{CHECK_AND_RETHROW(dispatch_play_packet_{mapper[id]}(arena, client, data, size));}} break;'
+    c += 'default: CHECK_FAIL_ERROR(ERROR_PROTOCOL, "Got unknown packet id: %d", packet_id);'
     c += '}\n'
     c += 'cleanup:\n'
     c += 'return err;'
@@ -1139,6 +1271,7 @@ h += '#include <stdbool.h>\n'
 h += '#include <stdint.h>\n'
 h += '\n'
 h += 'err_t dispatch_packet(client_t* client, uint8_t* data, int size);\n'
+h += 'err_t dispatch_play_packet(tick_arena_t* arena, client_handle_t client, int32_t packet_id, uint8_t* data, int size);\n'
 h += '\n'
 h += header + '\n'
 
@@ -0,0 +1,57 @@
+#include "huge_pages.h"
+
+#include "defs.h"
+
+#include <sys/mman.h>
+#include <stdint.h>
+
+#ifndef MAP_HUGE_2MB
+    #define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+void* huge_pages_map(size_t size, huge_page_kind_t* kind) {
+    size = ALIGN_UP(size, HUGE_PAGE_SIZE);
+
+    // try the reserved pool first, this fails right away if
+    // there are not enough free huge pages for the whole range
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    if (ptr != MAP_FAILED) {
+        *kind = HUGE_PAGES_HUGETLB;
+        return ptr;
+    }
+
+    // transparent huge pages only cover aligned huge pages, so map a huge
+    // page more than needed and cut the range to an aligned one
+    uint8_t* mapping = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    uint8_t* aligned = (uint8_t*)ALIGN_UP(mapping, HUGE_PAGE_SIZE);
+    if (aligned != mapping) {
+        munmap(mapping, aligned - mapping);
+    }
+    munmap(aligned + size, (mapping + HUGE_PAGE_SIZE) - aligned);
+
+    huge_pages_advise(aligned, size);
+    *kind = HUGE_PAGES_TRANSPARENT;
+    return aligned;
+}
+
+void huge_pages_advise(void* ptr, size_t size) {
+    // if the kernel has no transparent huge pages these are just normal pages
+    madvise(ptr, size, MADV_HUGEPAGE);
+}
+
+void huge_pages_release(void* ptr, size_t size, huge_page_kind_t kind) {
+    size_t page_size = kind == HUGE_PAGES_NONE ? PAGE_SIZE : HUGE_PAGE_SIZE;
+    uintptr_t start = ALIGN_UP((uintptr_t)ptr, page_size);
+    uintptr_t end = ALIGN_DOWN((uintptr_t)ptr + size, page_size);
+    if (start >= end) {
+        return;
+    }
+
+    // reserved huge pages can't be lazily freed, they go
+    // back to the pool right away
+    madvise((void*)start, end - start, kind == HUGE_PAGES_HUGETLB ? MADV_DONTNEED : MADV_FREE);
+}
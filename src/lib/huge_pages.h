@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * The size of the huge pages we use
+ */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef enum huge_page_kind {
+    // normal 4k pages
+    HUGE_PAGES_NONE,
+
+    // transparent huge pages, the kernel backs the range with huge
+    // pages when it has them but can still split them
+    HUGE_PAGES_TRANSPARENT,
+
+    // pages from the reserved huge page pool (vm.nr_hugepages), these
+    // are never split and can only be freed a whole page at a time
+    HUGE_PAGES_HUGETLB,
+} huge_page_kind_t;
+
+/**
+ * Map anonymous memory backed by huge pages, reserved huge pages are used if there
+ * are enough of them and otherwise the range is aligned and marked for transparent
+ * huge pages. The range is read write and not populated
+ *
+ * @param size      [IN]    The size, rounded up to the huge page size
+ * @param kind      [OUT]   The kind of pages the range got
+ *
+ * @return The range, aligned to the huge page size, or MAP_FAILED
+ */
+void* huge_pages_map(size_t size, huge_page_kind_t* kind);
+
+/**
+ * Ask for transparent huge pages for a range that is already mapped
+ *
+ * @param ptr       [IN] The range, should be aligned to the huge page size
+ * @param size      [IN] The size of the range
+ */
+void huge_pages_advise(void* ptr, size_t size);
+
+/**
+ * Tell the kernel that a part of the range is no longer used, only whole huge
+ * pages inside of the part are released so no huge page is ever split
+ *
+ * @param ptr       [IN] The start of the part
+ * @param size      [IN] The size of the part
+ * @param kind      [IN] The kind of pages the range was mapped with
+ */
+void huge_pages_release(void* ptr, size_t size, huge_page_kind_t kind);
@@ -30,7 +30,7 @@ static inline bool list_empty(list_t* head) {
 }
 
 static inline void list_add_tail(list_t* head, list_node_t* new_node) {
-    list_node_t* prev = head;
+    list_node_t* prev = head->prev;
     head->prev = new_node;
     new_node->next = head;
     new_node->prev = prev;
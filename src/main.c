@@ -1,5 +1,7 @@
 #include "lib/except.h"
 
+#include <minecraft/protocol/status.h>
+#include <minecraft/protocol/auth.h>
 #include <minecraft/tick_arena.h>
 #include <minecraft/game.h>
 
@@ -8,17 +10,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
-int main() {
+int main(int argc, char* argv[]) {
     err_t err = NO_ERROR;
 
+    server_config_t config;
+    server_get_default_config(&config);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--low-latency") == 0) {
+            config.low_latency = true;
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            config.huge_pages = true;
+        } else {
+            printf("Usage: %s [--low-latency] [--huge-pages]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     init_err_printf();
     TRACE("Initializing server");
-    CHECK_AND_RETHROW(init_tick_arenas());
-    CHECK_AND_RETHROW(start_game_loop());
+    CHECK_AND_RETHROW(init_tick_arenas(config.huge_pages));
+    if (access("server-icon.png", R_OK) == 0) {
+        CHECK_AND_RETHROW(status_load_favicon("server-icon.png"));
+    }
 
     TRACE("Starting server!");
-    CHECK_AND_RETHROW(init_server(NULL));
+    CHECK_AND_RETHROW(init_server(&config));
+    CHECK_AND_RETHROW(init_auth(config.login_workers));
+
+    // the game tick talks to the reactors, so it can only start once they exist
+    CHECK_AND_RETHROW(start_game_loop());
     CHECK_AND_RETHROW(server_start());
 
 cleanup:
@@ -1,6 +1,11 @@
 #include "game.h"
 
+#include <minecraft/protocol/status.h>
+#include <minecraft/protocol/play.h>
 #include <minecraft/tick_arena.h>
+#include <net/compression_control.h>
+#include <net/server.h>
+#include <minecraft_protodef.h>
 
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
@@ -38,6 +43,14 @@ cleanup:
     return err;
 }
 
+/**
+ * Process a packet of a playing client, this runs on the game thread
+ * so it can touch the world without any locks
+ */
+static err_t process_play_packet(server_packet_t* packet) {
+    return dispatch_play_packet(g_current_tick_arena, packet->client, packet->id, packet->data, packet->size);
+}
+
 /**
  * The actual game loop, this mainly manages the time and dispatches the initial
  * work that needs to happen every game tick
@@ -63,14 +76,28 @@ static int game_loop_thread(void* arg) {
         // switch the arenas
         g_current_tick_arena = switch_tick_arenas();
 
+        // process everything the clients sent since the last tick, their
+        // packets are in the arena of the last tick which is still valid
+        CHECK_AND_RETHROW(server_drain_packets(process_play_packet));
+
+        // publish the status changes of the last tick
+        status_set_online_players(server_playing_clients());
+        status_tick();
+
+        // hand everything the tick sent to the reactors
+        server_flush_game_sends();
+
         struct timespec tick_end;
         CHECK_ERRNO(clock_gettime(CLOCK_MONOTONIC, &tick_end) == 0);
         // TICK END
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+        // let the compression know how much time we have left
+        uint64_t tick_ns = (tick_end.tv_sec - tick_start.tv_sec) * 1000000000ull + (tick_end.tv_nsec - tick_start.tv_nsec);
+        compression_control_tick(tick_ns);
+
         // sleep for the duration we need to sleep
-        long tick_duration = (tick_end.tv_sec - tick_start.tv_sec) * 1000 +
-                                (tick_end.tv_nsec - tick_start.tv_nsec) / 1000000000;
+        long tick_duration = tick_ns / 1000000;
         CHECK_AND_RETHROW(safe_sleep((1000 / 20) - tick_duration));
 
         // ticks per second for fun and profit
@@ -78,6 +105,13 @@ static int game_loop_thread(void* arg) {
             TRACE("Current TPS: %d", tps);
             start = time(NULL);
             tps = 0;
+
+            // and how well the clients keep up with what we send them
+            server_stats_t stats;
+            server_get_stats(&stats);
+            TRACE("Send queues: %zu bytes queued (peak client %zu), %zu dropped, %zu merged, %zu kicked",
+                  stats.queued_bytes, stats.peak_client_queued_bytes,
+                  stats.dropped_packets, stats.merged_packets, stats.kicked_clients);
         }
     }
 
@@ -89,6 +123,7 @@ err_t start_game_loop() {
     err_t err = NO_ERROR;
 
     TRACE("Starting game loop");
+    CHECK_AND_RETHROW(init_play());
     CHECK_ERRNO(thrd_create(&m_game_loop_thread, game_loop_thread, NULL) == 0);
 
 cleanup:
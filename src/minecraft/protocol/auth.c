@@ -0,0 +1,165 @@
+#include "auth.h"
+
+#include <net/buffer_pool.h>
+#include <net/worker_pool.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include <threads.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/**
+ * The packet id of the encryption request
+ */
+#define ENCRYPTION_REQUEST_ID 0x01
+
+/**
+ * The keypair of the server, generated once at startup
+ */
+static EVP_PKEY* m_keypair = NULL;
+
+/**
+ * The encryption request without the verify token, this is the same for every client
+ * so it is encoded once, only the verify token is appended per client
+ */
+static uint8_t* m_encryption_request = NULL;
+static int m_encryption_request_size = 0;
+
+/**
+ * The workers that do the RSA decrypts
+ */
+static worker_pool_t m_login_workers = { 0 };
+
+/**
+ * The decrypt context of the worker, setting one up is not free
+ * so every worker keeps its own
+ */
+static thread_local EVP_PKEY_CTX* m_decrypt_ctx = NULL;
+
+err_t init_auth(int workers) {
+    err_t err = NO_ERROR;
+    uint8_t* der = NULL;
+
+    // generate the keypair, the protocol only allows RSA-1024
+    m_keypair = EVP_RSA_gen(AUTH_RSA_BLOB_SIZE * 8);
+    CHECK(m_keypair != NULL, "Failed to generate the server keypair");
+
+    // encode the public key
+    int der_size = i2d_PUBKEY(m_keypair, &der);
+    CHECK(der_size > 0, "Failed to encode the server public key");
+
+    // and the encryption request around it: the id, an empty server
+    // id, the public key and the size of the verify token
+    m_encryption_request = malloc(5 * 3 + der_size + 1);
+    CHECK_ERRNO(m_encryption_request != NULL);
+    uint8_t* out = m_encryption_request;
+    out += protocol_write_varint(out, 5, ENCRYPTION_REQUEST_ID);
+    out += protocol_write_varint(out, 5, 0);
+    out += protocol_write_varint(out, 5, der_size);
+    memcpy(out, der, der_size);
+    out += der_size;
+    out += protocol_write_varint(out, 5, sizeof(((client_t*)NULL)->login.verify_token));
+    m_encryption_request_size = out - m_encryption_request;
+
+    CHECK_AND_RETHROW(init_worker_pool(&m_login_workers, "login", workers));
+
+cleanup:
+    OPENSSL_free(der);
+    return err;
+}
+
+err_t auth_send_encryption_request(client_t* client) {
+    err_t err = NO_ERROR;
+
+    uint8_t* buffer = buffer_pool_get_protocol_send();
+    CHECK_ERRNO(buffer != NULL);
+
+    CHECK(RAND_bytes(client->login.verify_token, sizeof(client->login.verify_token)) == 1);
+
+    uint8_t* data = buffer + SERVER_SEND_HEADROOM;
+    memcpy(data, m_encryption_request, m_encryption_request_size);
+    memcpy(data + m_encryption_request_size, client->login.verify_token, sizeof(client->login.verify_token));
+
+    // the server owns the buffer from here on, even if sending fails
+    uint8_t* packet_buffer = buffer;
+    buffer = NULL;
+    CHECK_AND_RETHROW(server_send_packet(client, packet_buffer, m_encryption_request_size + sizeof(client->login.verify_token), SEND_NORMAL, 0));
+
+cleanup:
+    if (IS_ERROR(err) && buffer != NULL) {
+        buffer_pool_return_protocol_send(buffer);
+    }
+    return err;
+}
+
+/**
+ * Decrypt a single blob in place
+ */
+static bool decrypt_blob(uint8_t* blob, int* size) {
+    uint8_t plain[AUTH_RSA_BLOB_SIZE];
+    size_t plain_size = sizeof(plain);
+    if (EVP_PKEY_decrypt(m_decrypt_ctx, plain, &plain_size, blob, *size) <= 0) {
+        return false;
+    }
+    memcpy(blob, plain, plain_size);
+    *size = plain_size;
+    return true;
+}
+
+/**
+ * Decrypt the response, this runs on a login worker
+ */
+static void decrypt_response(worker_job_t* worker_job) {
+    auth_job_t* job = (auth_job_t*)worker_job;
+    job->decrypted = false;
+
+    if (m_decrypt_ctx == NULL) {
+        EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(m_keypair, NULL);
+        if (ctx == NULL) {
+            return;
+        }
+        if (EVP_PKEY_decrypt_init(ctx) <= 0 || EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0) {
+            EVP_PKEY_CTX_free(ctx);
+            return;
+        }
+        m_decrypt_ctx = ctx;
+    }
+
+    job->decrypted = decrypt_blob(job->shared_secret, &job->shared_secret_size) &&
+                     decrypt_blob(job->verify_token, &job->verify_token_size);
+}
+
+err_t auth_decrypt(auth_job_t* job) {
+    err_t err = NO_ERROR;
+
+    job->work.job.run = decrypt_response;
+    CHECK_AND_RETHROW(server_offload(&m_login_workers, &job->work));
+
+cleanup:
+    return err;
+}
+
+err_t auth_verify_session(const char* username, uuid_t* uuid) {
+    err_t err = NO_ERROR;
+
+    // the offline mode uuid, a version 3 uuid of "OfflinePlayer:<name>"
+    char name[64];
+    int name_size = snprintf(name, sizeof(name), "OfflinePlayer:%s", username);
+    CHECK(name_size > 0 && name_size < sizeof(name));
+
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    CHECK(EVP_Digest(name, name_size, digest, NULL, EVP_md5(), NULL) == 1);
+    digest[6] = (digest[6] & 0x0F) | 0x30;
+    digest[8] = (digest[8] & 0x3F) | 0x80;
+
+    // uuids are written as is
+    _Static_assert(sizeof(uuid_t) == 16, "Invalid uuid size");
+    memcpy(uuid, digest, sizeof(uuid_t));
+
+cleanup:
+    return err;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <minecraft/protocol/protocol.h>
+#include <net/server.h>
+#include <lib/except.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The size of the RSA blobs the client sends back, everything is
+ * encrypted with our RSA-1024 public key
+ */
+#define AUTH_RSA_BLOB_SIZE 128
+
+/**
+ * The RSA decrypt of the encryption response, this runs on a login worker
+ */
+typedef struct auth_job {
+    // the work, the client and the completion are set by the caller
+    server_work_t work;
+
+    // the encrypted shared secret and verify token, they are
+    // decrypted in place and the sizes are updated
+    uint8_t shared_secret[AUTH_RSA_BLOB_SIZE];
+    int shared_secret_size;
+    uint8_t verify_token[AUTH_RSA_BLOB_SIZE];
+    int verify_token_size;
+
+    // did both of them decrypt
+    bool decrypted;
+} auth_job_t;
+
+/**
+ * Generate the server keypair and start the login workers, the public
+ * key is encoded once and reused for every encryption request
+ *
+ * @param workers   [IN] The amount of login workers
+ */
+err_t init_auth(int workers);
+
+/**
+ * Send the encryption request to the client, this generates a new
+ * verify token for the client
+ *
+ * @param client    [IN] The client
+ */
+err_t auth_send_encryption_request(client_t* client);
+
+/**
+ * Decrypt the encryption response on a login worker, the completion
+ * of the work runs on the reactor once it is done
+ *
+ * @param job   [IN] The job, must stay alive until it completes
+ */
+err_t auth_decrypt(auth_job_t* job);
+
+/**
+ * Check that the player has joined through the session server
+ *
+ * TODO: this is a local stub for now, it trusts the client
+ *       and gives it the offline mode uuid of its name
+ *
+ * @param username  [IN]    The name the player logged in with
+ * @param uuid      [OUT]   The uuid of the player
+ */
+err_t auth_verify_session(const char* username, uuid_t* uuid);
@@ -1,11 +1,24 @@
+#include "auth.h"
 
 #include <minecraft_protodef.h>
+#include <net/server.h>
 #include <lib/except.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 err_t process_login_packet_login_start(tick_arena_t* arena, client_t* client, login_packet_login_start_t* packet) {
     err_t err = NO_ERROR;
 
-    
+    CHECK_ERROR(!client->login.encryption_requested, ERROR_PROTOCOL, "Got login start twice");
+    CHECK_ERROR(packet->username.length > 0 && packet->username.length < sizeof(client->login.username),
+                ERROR_PROTOCOL, "Invalid username length: %d", packet->username.length);
+    memcpy(client->login.username, packet->username.elements, packet->username.length);
+    client->login.username[packet->username.length] = '\0';
+
+    // the rest of the login is encrypted
+    CHECK_AND_RETHROW(auth_send_encryption_request(client));
+    client->login.encryption_requested = true;
 
 cleanup:
     return err;
@@ -20,11 +33,72 @@ cleanup:
     return err;
 }
 
+/**
+ * The encryption response was decrypted, finish the login
+ */
+static err_t complete_key_exchange(server_work_t* work) {
+    err_t err = NO_ERROR;
+    auth_job_t* job = (auth_job_t*)work;
+    client_t* client = work->client;
+
+    // the client is gone, nothing to finish
+    if (client->closing) {
+        goto cleanup;
+    }
+    client->login.key_exchange = false;
+
+    CHECK_ERROR(job->decrypted, ERROR_PROTOCOL, "Failed to decrypt the encryption response");
+    CHECK_ERROR(job->verify_token_size == sizeof(client->login.verify_token) &&
+                memcmp(job->verify_token, client->login.verify_token, sizeof(client->login.verify_token)) == 0,
+                ERROR_PROTOCOL, "Invalid verify token");
+    CHECK_ERROR(job->shared_secret_size == 16, ERROR_PROTOCOL, "Invalid shared secret size: %d", job->shared_secret_size);
+
+    login_packet_success_t success = {
+        .username = {
+            .length = strlen(client->login.username),
+            .elements = client->login.username
+        }
+    };
+    CHECK_AND_RETHROW(auth_verify_session(client->login.username, &success.uuid));
+
+    // everything from now on is encrypted, and then compressed
+    server_enable_encryption(client, job->shared_secret);
+    CHECK_AND_RETHROW(server_enable_compression(client));
+    CHECK_AND_RETHROW(send_login_packet_success(client, &success));
+    server_enter_play(client);
+
+cleanup:
+    free(job);
+    return err;
+}
+
 err_t process_login_packet_encryption_response(tick_arena_t* arena, client_t* client, login_packet_encryption_response_t* packet) {
     err_t err = NO_ERROR;
+    auth_job_t* job = NULL;
+
+    CHECK_ERROR(client->login.encryption_requested, ERROR_PROTOCOL, "Invalid encryption response, no request was sent");
+    CHECK_ERROR(!client->login.key_exchange, ERROR_PROTOCOL, "Got encryption response twice");
+    CHECK_ERROR(packet->shared_secret.length == AUTH_RSA_BLOB_SIZE && packet->verify_token.length == AUTH_RSA_BLOB_SIZE,
+                ERROR_PROTOCOL, "Invalid encryption response sizes: %d, %d",
+                packet->shared_secret.length, packet->verify_token.length);
+
+    // the packet lives in the tick arena, so copy it for the worker
+    job = malloc(sizeof(auth_job_t));
+    CHECK_ERRNO(job != NULL);
+    job->work.client = client;
+    job->work.complete = complete_key_exchange;
+    memcpy(job->shared_secret, packet->shared_secret.elements, AUTH_RSA_BLOB_SIZE);
+    job->shared_secret_size = AUTH_RSA_BLOB_SIZE;
+    memcpy(job->verify_token, packet->verify_token.elements, AUTH_RSA_BLOB_SIZE);
+    job->verify_token_size = AUTH_RSA_BLOB_SIZE;
 
-    CHECK_FAIL_ERROR(ERROR_PROTOCOL, "Invalid encryption response, no request was sent");
+    // the completion owns the job from here on
+    client->login.key_exchange = true;
+    auth_job_t* offloaded_job = job;
+    job = NULL;
+    CHECK_AND_RETHROW(auth_decrypt(offloaded_job));
 
 cleanup:
+    free(job);
     return err;
 }
@@ -0,0 +1,291 @@
+#include "play.h"
+
+#include <minecraft_protodef.h>
+#include <net/server.h>
+#include <lib/except.h>
+
+#include <stdlib.h>
+#include <math.h>
+
+/**
+ * The limits the vanilla server puts on the position of a player, anything
+ * further away is treated as a broken (or malicious) client
+ */
+#define MAX_HORIZONTAL_COORDINATE   3.0e7
+#define MAX_VERTICAL_COORDINATE     2.0e7
+
+/**
+ * The length of a chat message, in bytes
+ */
+#define MAX_CHAT_LENGTH             256
+
+/**
+ * The view distances the client can ask for
+ */
+#define MIN_VIEW_DISTANCE           2
+#define MAX_VIEW_DISTANCE           32
+
+/**
+ * The state of a playing client, as the game tick sees it
+ */
+typedef struct player {
+    // the generation of the client this is for, a new client in the
+    // same slot gets a fresh player
+    uint32_t generation;
+
+    // where the player is
+    double x;
+    double y;
+    double z;
+    float yaw;
+    float pitch;
+    bool on_ground;
+
+    // the hotbar slot the player is holding
+    int held_slot;
+
+    // from the client settings
+    int view_distance;
+    int main_hand;
+} player_t;
+
+/**
+ * The players, indexed by the reactor and the slot of the client
+ */
+static player_t* m_players = NULL;
+static int m_players_per_reactor = 0;
+
+err_t init_play() {
+    err_t err = NO_ERROR;
+
+    // the same amount of slots every reactor has for its clients
+    m_players_per_reactor = g_server_config.max_connections / g_server_config.reactor_count + 1;
+    m_players = calloc(g_server_config.reactor_count * m_players_per_reactor, sizeof(player_t));
+    CHECK_ERRNO(m_players != NULL);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Get the player of the client, the first packet of a client resets it
+ */
+static player_t* get_player(client_handle_t client) {
+    player_t* player = &m_players[client.reactor * m_players_per_reactor + client.slot];
+    if (player->generation != client.generation) {
+        *player = (player_t){
+            .generation = client.generation,
+            .view_distance = MIN_VIEW_DISTANCE,
+            .main_hand = 1,
+        };
+    }
+    return player;
+}
+
+static bool valid_position(double x, double y, double z) {
+    return isfinite(x) && isfinite(y) && isfinite(z) &&
+           fabs(x) <= MAX_HORIZONTAL_COORDINATE &&
+           fabs(y) <= MAX_VERTICAL_COORDINATE &&
+           fabs(z) <= MAX_HORIZONTAL_COORDINATE;
+}
+
+static bool valid_hand(int32_t hand) {
+    return hand == 0 || hand == 1;
+}
+
+err_t process_play_packet_position(tick_arena_t* arena, client_handle_t client, play_packet_position_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(valid_position(packet->x, packet->y, packet->z), ERROR_PROTOCOL, "Invalid move player packet received");
+
+    player_t* player = get_player(client);
+    player->x = packet->x;
+    player->y = packet->y;
+    player->z = packet->z;
+    player->on_ground = packet->on_ground;
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_position_look(tick_arena_t* arena, client_handle_t client, play_packet_position_look_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(valid_position(packet->x, packet->y, packet->z) && isfinite(packet->yaw) && isfinite(packet->pitch),
+                ERROR_PROTOCOL, "Invalid move player packet received");
+
+    player_t* player = get_player(client);
+    player->x = packet->x;
+    player->y = packet->y;
+    player->z = packet->z;
+    player->yaw = packet->yaw;
+    player->pitch = packet->pitch;
+    player->on_ground = packet->on_ground;
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_look(tick_arena_t* arena, client_handle_t client, play_packet_look_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(isfinite(packet->yaw) && isfinite(packet->pitch), ERROR_PROTOCOL, "Invalid move player packet received");
+
+    player_t* player = get_player(client);
+    player->yaw = packet->yaw;
+    player->pitch = packet->pitch;
+    player->on_ground = packet->on_ground;
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_flying(tick_arena_t* arena, client_handle_t client, play_packet_flying_t* packet) {
+    get_player(client)->on_ground = packet->on_ground;
+    return NO_ERROR;
+}
+
+err_t process_play_packet_vehicle_move(tick_arena_t* arena, client_handle_t client, play_packet_vehicle_move_t* packet) {
+    err_t err = NO_ERROR;
+
+    // there are no vehicles yet, but a broken position is still a broken client
+    CHECK_ERROR(valid_position(packet->x, packet->y, packet->z) && isfinite(packet->yaw) && isfinite(packet->pitch),
+                ERROR_PROTOCOL, "Invalid move vehicle packet received");
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_held_item_slot(tick_arena_t* arena, client_handle_t client, play_packet_held_item_slot_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(packet->slot_id >= 0 && packet->slot_id < 9, ERROR_PROTOCOL, "Invalid held item slot: %d", packet->slot_id);
+    get_player(client)->held_slot = packet->slot_id;
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_settings(tick_arena_t* arena, client_handle_t client, play_packet_settings_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(valid_hand(packet->main_hand), ERROR_PROTOCOL, "Invalid main hand: %d", packet->main_hand);
+
+    player_t* player = get_player(client);
+    player->main_hand = packet->main_hand;
+    player->view_distance = packet->view_distance < MIN_VIEW_DISTANCE ? MIN_VIEW_DISTANCE :
+                            packet->view_distance > MAX_VIEW_DISTANCE ? MAX_VIEW_DISTANCE :
+                            packet->view_distance;
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_chat(tick_arena_t* arena, client_handle_t client, play_packet_chat_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(packet->message.length <= MAX_CHAT_LENGTH, ERROR_PROTOCOL, "Chat message too long: %d", packet->message.length);
+
+    // the same characters the vanilla server does not allow, control
+    // characters and the section sign (C2 A7 in utf8) used for formatting
+    for (int i = 0; i < packet->message.length; i++) {
+        uint8_t c = packet->message.elements[i];
+        CHECK_ERROR(c >= ' ' && c != 0x7F, ERROR_PROTOCOL, "Illegal characters in chat");
+        CHECK_ERROR(!(c == 0xC2 && i + 1 < packet->message.length && (uint8_t)packet->message.elements[i + 1] == 0xA7),
+                    ERROR_PROTOCOL, "Illegal characters in chat");
+    }
+
+    // TODO: send it to everyone once the play packets can be sent
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_client_command(tick_arena_t* arena, client_handle_t client, play_packet_client_command_t* packet) {
+    err_t err = NO_ERROR;
+
+    // either respawn or request the statistics
+    CHECK_ERROR(packet->action_id == 0 || packet->action_id == 1, ERROR_PROTOCOL, "Invalid client command: %d", packet->action_id);
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_arm_animation(tick_arena_t* arena, client_handle_t client, play_packet_arm_animation_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(valid_hand(packet->hand), ERROR_PROTOCOL, "Invalid hand: %d", packet->hand);
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_use_item(tick_arena_t* arena, client_handle_t client, play_packet_use_item_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(valid_hand(packet->hand), ERROR_PROTOCOL, "Invalid hand: %d", packet->hand);
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_block_place(tick_arena_t* arena, client_handle_t client, play_packet_block_place_t* packet) {
+    err_t err = NO_ERROR;
+
+    CHECK_ERROR(valid_hand(packet->hand), ERROR_PROTOCOL, "Invalid hand: %d", packet->hand);
+
+cleanup:
+    return err;
+}
+
+err_t process_play_packet_keep_alive(tick_arena_t* arena, client_handle_t client, play_packet_keep_alive_t* packet) {
+    // the reactor already took the packet as a sign of life
+    // when it got it, there is nothing left for the tick
+    return NO_ERROR;
+}
+
+/**
+ * Packets about things the server has no state for yet (the world, entities, windows
+ * and the like). They are still fully parsed so a malformed one drops the client, but
+ * there is nothing to apply them to
+ */
+#define PLAY_PACKET_WITHOUT_STATE(name) \
+    err_t process_play_packet_##name(tick_arena_t* arena, client_handle_t client, play_packet_##name##_t* packet) { \
+        return NO_ERROR; \
+    }
+
+PLAY_PACKET_WITHOUT_STATE(teleport_confirm)
+PLAY_PACKET_WITHOUT_STATE(query_block_nbt)
+PLAY_PACKET_WITHOUT_STATE(set_difficulty)
+PLAY_PACKET_WITHOUT_STATE(edit_book)
+PLAY_PACKET_WITHOUT_STATE(query_entity_nbt)
+PLAY_PACKET_WITHOUT_STATE(pick_item)
+PLAY_PACKET_WITHOUT_STATE(name_item)
+PLAY_PACKET_WITHOUT_STATE(select_trade)
+PLAY_PACKET_WITHOUT_STATE(set_beacon_effect)
+PLAY_PACKET_WITHOUT_STATE(update_command_block)
+PLAY_PACKET_WITHOUT_STATE(update_command_block_minecart)
+PLAY_PACKET_WITHOUT_STATE(update_structure_block)
+PLAY_PACKET_WITHOUT_STATE(tab_complete)
+PLAY_PACKET_WITHOUT_STATE(enchant_item)
+PLAY_PACKET_WITHOUT_STATE(window_click)
+PLAY_PACKET_WITHOUT_STATE(close_window)
+PLAY_PACKET_WITHOUT_STATE(custom_payload)
+PLAY_PACKET_WITHOUT_STATE(use_entity)
+PLAY_PACKET_WITHOUT_STATE(generate_structure)
+PLAY_PACKET_WITHOUT_STATE(lock_difficulty)
+PLAY_PACKET_WITHOUT_STATE(steer_boat)
+PLAY_PACKET_WITHOUT_STATE(craft_recipe_request)
+PLAY_PACKET_WITHOUT_STATE(abilities)
+PLAY_PACKET_WITHOUT_STATE(block_dig)
+PLAY_PACKET_WITHOUT_STATE(entity_action)
+PLAY_PACKET_WITHOUT_STATE(steer_vehicle)
+PLAY_PACKET_WITHOUT_STATE(displayed_recipe)
+PLAY_PACKET_WITHOUT_STATE(recipe_book)
+PLAY_PACKET_WITHOUT_STATE(resource_pack_receive)
+PLAY_PACKET_WITHOUT_STATE(set_creative_slot)
+PLAY_PACKET_WITHOUT_STATE(update_jigsaw_block)
+PLAY_PACKET_WITHOUT_STATE(update_sign)
+PLAY_PACKET_WITHOUT_STATE(spectate)
+PLAY_PACKET_WITHOUT_STATE(advancement_tab)
+PLAY_PACKET_WITHOUT_STATE(pong)
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <lib/except.h>
+
+/**
+ * Allocate the state of the players, called before the game loop starts
+ * since it is only ever touched by the game thread
+ */
+err_t init_play();
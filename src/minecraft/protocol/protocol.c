@@ -1,6 +1,11 @@
 #include "protocol.h"
 
 #include <endian.h>
+#include <string.h>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 uint8_t protocol_read_u8(uint8_t* buffer) {
     return *buffer;
@@ -67,19 +72,30 @@ void protocol_write_i64(uint8_t* buffer, int64_t value) {
 }
 
 float protocol_read_f32(uint8_t* buffer) {
-    return *((float*)buffer);
+    // floats are big endian on the wire as well
+    uint32_t bits = be32toh(*((uint32_t*)buffer));
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
 }
 
 void protocol_write_f32(uint8_t* buffer, float value) {
-    *((float*)buffer) = value;
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    *((uint32_t*)buffer) = htobe32(bits);
 }
 
 double protocol_read_f64(uint8_t* buffer) {
-    return *((double*)buffer);
+    uint64_t bits = be64toh(*((uint64_t*)buffer));
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
 }
 
 void protocol_write_f64(uint8_t* buffer, double value) {
-    *((double*)buffer) = value;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    *((uint64_t*)buffer) = htobe64(bits);
 }
 
 bool protocol_read_bool(uint8_t* buffer) {
@@ -90,68 +106,206 @@ void protocol_write_bool(uint8_t* buffer, bool value) {
     *buffer = value ? 0x01 : 0x00;
 }
 
-int protocol_read_varint(uint8_t* buffer, int size, int32_t* value) {
-    int original_size = size;
-    int shift = 0;
-    while (true) {
-        if (size <= 0) return -1;
-        uint8_t b = *buffer;
-        buffer++;
-        size--;
-        *value |= ((b & 0x7F) << shift);
-        if (!(b & 0x80)) {
-            break;
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Varints
+//
+// Varints are read as a single little endian word when the buffer has room for one, the 7 bit groups are
+// gathered from the low 7 bits of every byte so there is no loop over the bytes. Anything that does not
+// fit in a word falls back to going a byte at a time.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define VARINT_MAX_LENGTH       5
+#define VARLONG_MAX_LENGTH      10
+
+#define VARINT_PAYLOAD_BITS     0x7f7f7f7f7f7f7f7full
+#define VARINT_CONTINUE_BITS    0x8080808080808080ull
+
+/**
+ * Gather the 7 bit groups of the bytes into a value
+ */
+static inline uint64_t varint_squash(uint64_t bytes) {
+#ifdef __BMI2__
+    return _pext_u64(bytes, VARINT_PAYLOAD_BITS);
+#else
+    // merge neighbouring groups, 7 bits in every 8, then 14 in
+    // every 16, then 28 in every 32 and 56 in the whole word
+    bytes &= VARINT_PAYLOAD_BITS;
+    bytes = (bytes & 0x00ff00ff00ff00ffull) | ((bytes & 0xff00ff00ff00ff00ull) >> 1);
+    bytes = (bytes & 0x0000ffff0000ffffull) | ((bytes & 0xffff0000ffff0000ull) >> 2);
+    bytes = (bytes & 0x00000000ffffffffull) | ((bytes & 0xffffffff00000000ull) >> 4);
+    return bytes;
+#endif
+}
+
+/**
+ * Try to decode a varint of up to 8 bytes with a single load, the buffer must have at least 8 bytes
+ *
+ * @return The length of the varint, 0 if it is longer than 8 bytes
+ */
+static inline int varint_read_word(const uint8_t* buffer, uint64_t* value) {
+    uint64_t bytes;
+    memcpy(&bytes, buffer, sizeof(bytes));
+    bytes = le64toh(bytes);
+
+    // the length is found with branches instead of from the continuation bits, it
+    // is almost always predicted so whatever is read next does not wait for it
+    int length;
+    if ((bytes & 0x80) == 0) {
+        length = 1;
+    } else if ((bytes & 0x8000) == 0) {
+        length = 2;
+    } else if ((bytes & 0x800000) == 0) {
+        length = 3;
+    } else if ((bytes & 0x80000000) == 0) {
+        length = 4;
+    } else {
+        uint64_t ends = ~bytes & VARINT_CONTINUE_BITS;
+        if (ends == 0) {
+            return 0;
         }
-        shift += 7;
-        if (shift >= 32) return -1;
+        length = (__builtin_ctzll(ends) >> 3) + 1;
     }
-    return original_size - size;
-}
 
-int protocol_write_varint(uint8_t* buffer, int size, int32_t value) {
-    return protocol_write_varlong(buffer, size, value);
+    *value = varint_squash(bytes & (~0ull >> (64 - 8 * length)));
+    return length;
 }
 
-int protocol_read_varlong(uint8_t* buffer, int size, int64_t* value) {
-    int original_size = size;
-    int shift = 0;
-    while (true) {
-        if (size <= 0) return -1;
-        uint8_t b = *buffer;
-        buffer++;
-        size--;
-        *value |= ((b & 0x7F) << shift);
+/**
+ * Decode a varint a byte at a time
+ *
+ * @return The length of the varint, -1 if it is too long or the buffer ended
+ */
+static int varint_read_bytes(const uint8_t* buffer, int size, int max_length, uint64_t* value) {
+    uint64_t result = 0;
+    for (int i = 0; i < max_length && i < size; i++) {
+        uint8_t b = buffer[i];
+        result |= (uint64_t)(b & 0x7F) << (i * 7);
         if (!(b & 0x80)) {
-            break;
+            *value = result;
+            return i + 1;
         }
-        shift += 7;
-        if (shift >= 64) return -1;
     }
-    return original_size - size;
+    return -1;
 }
 
-int protocol_write_varlong(uint8_t* buffer, int size, int64_t value) {
-    int original_size = size;
-
+/**
+ * Encode a varint a byte at a time
+ *
+ * @return The length of the varint, -1 if it does not fit in the size
+ */
+static int varint_write_bytes(uint8_t* buffer, int size, uint64_t value) {
+    int length = 0;
     do {
-        // get the current byte and move the value
-        uint8_t current_byte = value & 0x7f;
+        if (length >= size) {
+            return -1;
+        }
+        uint8_t current_byte = value & 0x7F;
         value >>= 7;
-
-        if (value) {
+        if (value != 0) {
             // we have more bytes ahead
             current_byte |= 0x80;
         }
+        buffer[length++] = current_byte;
+    } while (value != 0);
+    return length;
+}
+
+int protocol_varint_size(int32_t value) {
+    // ceil(bits / 7) without a division
+    int bits = 32 - __builtin_clz((uint32_t)value | 1);
+    return (bits * 9 + 64) >> 6;
+}
 
-        // push it
-        *buffer = current_byte;
-        buffer++;
-        size--;
+int protocol_varlong_size(int64_t value) {
+    int bits = 64 - __builtin_clzll((uint64_t)value | 1);
+    return (bits * 9 + 64) >> 6;
+}
 
-        // if no more values exit
-    } while (value);
+int protocol_read_varint(uint8_t* buffer, int size, int32_t* value) {
+    // most varints are a single byte
+    if (size > 0 && buffer[0] < 0x80) {
+        *value = buffer[0];
+        return 1;
+    }
+
+    uint64_t result = 0;
+    int length;
+    if (size >= 8) {
+        length = varint_read_word(buffer, &result);
+        if (length == 0 || length > VARINT_MAX_LENGTH) {
+            return -1;
+        }
+    } else {
+        length = varint_read_bytes(buffer, size, VARINT_MAX_LENGTH, &result);
+        if (length < 0) {
+            return -1;
+        }
+    }
 
-    return original_size - size;
+    // the bits of the last byte past 32 bits are dropped, same as the client
+    *value = (int32_t)(uint32_t)result;
+    return length;
+}
+
+int protocol_write_varint(uint8_t* buffer, int size, int32_t value) {
+    // negative values are encoded as unsigned, so they always take 5 bytes
+    uint32_t bits = (uint32_t)value;
+    if (size < VARINT_MAX_LENGTH) {
+        return varint_write_bytes(buffer, size, bits);
+    }
+
+    // unrolled, the branches are predicted for the usual values and no store
+    // waits on the length. This was faster than building the bytes in a word
+    // (with or without pdep) and storing them at once
+    if (bits < (1u << 7)) {
+        buffer[0] = bits;
+        return 1;
+    }
+    buffer[0] = bits | 0x80;
+    if (bits < (1u << 14)) {
+        buffer[1] = bits >> 7;
+        return 2;
+    }
+    buffer[1] = (bits >> 7) | 0x80;
+    if (bits < (1u << 21)) {
+        buffer[2] = bits >> 14;
+        return 3;
+    }
+    buffer[2] = (bits >> 14) | 0x80;
+    if (bits < (1u << 28)) {
+        buffer[3] = bits >> 21;
+        return 4;
+    }
+    buffer[3] = (bits >> 21) | 0x80;
+    buffer[4] = bits >> 28;
+    return 5;
+}
+
+int protocol_read_varlong(uint8_t* buffer, int size, int64_t* value) {
+    if (size > 0 && buffer[0] < 0x80) {
+        *value = buffer[0];
+        return 1;
+    }
+
+    uint64_t result = 0;
+    int length = 0;
+    if (size >= 8) {
+        length = varint_read_word(buffer, &result);
+    }
+    if (length == 0) {
+        // too short for a word or longer than 8 bytes
+        length = varint_read_bytes(buffer, size, VARLONG_MAX_LENGTH, &result);
+        if (length < 0) {
+            return -1;
+        }
+    }
+
+    *value = (int64_t)result;
+    return length;
+}
+
+int protocol_write_varlong(uint8_t* buffer, int size, int64_t value) {
+    return varint_write_bytes(buffer, size, (uint64_t)value);
 }
 
 uuid_t protocol_read_uuid(uint8_t* buffer) {
@@ -45,9 +45,21 @@ double protocol_read_f64(uint8_t* buffer);
 void protocol_write_f64(uint8_t* buffer, double value);
 bool protocol_read_bool(uint8_t* buffer);
 void protocol_write_bool(uint8_t* buffer, bool value);
+
+/**
+ * The varint functions return the amount of bytes read or written, or -1 if the varint
+ * is invalid or does not fit in the size
+ */
 int protocol_read_varint(uint8_t* buffer, int size, int32_t* value);
 int protocol_write_varint(uint8_t* buffer, int size, int32_t value);
 int protocol_read_varlong(uint8_t* buffer, int size, int64_t* value);
 int protocol_write_varlong(uint8_t* buffer, int size, int64_t value);
+
+/**
+ * The amount of bytes the value takes when written as a varint (or varlong)
+ */
+int protocol_varint_size(int32_t value);
+int protocol_varlong_size(int64_t value);
+
 uuid_t protocol_read_uuid(uint8_t* buffer);
 void protocol_write_uuid(uint8_t* buffer, uuid_t uuid);
@@ -1,44 +1,196 @@
+#include "status.h"
 
 #include <minecraft_protodef.h>
+#include <net/admission.h>
+#include <net/server.h>
 #include <lib/except.h>
 
-err_t process_status_packet_ping(tick_arena_t* arena, client_t* client, status_packet_ping_t* packet) {
+#include <stdatomic.h>
+#include <threads.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// TODO: parse from json
+#define VERSION_NAME "1.18.1"
+#define PROTOCOL_VERSION 757
+
+/**
+ * The server icon as a data url, only set before the server starts
+ */
+static char* m_favicon = NULL;
+
+/**
+ * The online players count, picked up by the status response on the next tick
+ */
+static atomic_int m_online_players = 0;
+static atomic_bool m_status_changed = false;
+
+/**
+ * The generation of the status, incremented whenever it changes, a
+ * cached response with an older generation needs to be re-encoded
+ */
+static atomic_size_t m_status_generation = 1;
+
+/**
+ * The status response of this reactor, already framed and ready to be sent
+ * as is. Every reactor keeps its own copy so refreshing it needs no locking
+ */
+static thread_local struct {
+    size_t generation;
+    char* json;
+    size_t json_capacity;
+    uint8_t* frame;
+    size_t frame_capacity;
+    size_t frame_size;
+} m_status_response = { 0 };
+
+err_t status_load_favicon(const char* path) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char prefix[] = "data:image/png;base64,";
     err_t err = NO_ERROR;
+    uint8_t* data = NULL;
+
+    FILE* file = fopen(path, "rb");
+    CHECK_ERRNO(file != NULL, "Failed to open favicon %s", path);
+
+    // read the whole image
+    CHECK_ERRNO(fseek(file, 0, SEEK_END) == 0);
+    long size = ftell(file);
+    CHECK_ERRNO(size >= 0);
+    CHECK_ERRNO(fseek(file, 0, SEEK_SET) == 0);
+    data = malloc(size);
+    CHECK_ERRNO(data != NULL);
+    CHECK_ERRNO(fread(data, 1, size, file) == size);
+
+    // and encode it as a data url
+    char* favicon = malloc(sizeof(prefix) + (size + 2) / 3 * 4);
+    CHECK_ERRNO(favicon != NULL);
+    memcpy(favicon, prefix, sizeof(prefix) - 1);
+    char* out = favicon + sizeof(prefix) - 1;
+    for (long i = 0; i < size; i += 3) {
+        uint32_t value = data[i] << 16;
+        if (i + 1 < size) value |= data[i + 1] << 8;
+        if (i + 2 < size) value |= data[i + 2];
+        *out++ = alphabet[(value >> 18) & 0x3F];
+        *out++ = alphabet[(value >> 12) & 0x3F];
+        *out++ = i + 1 < size ? alphabet[(value >> 6) & 0x3F] : '=';
+        *out++ = i + 2 < size ? alphabet[value & 0x3F] : '=';
+    }
+    *out = '\0';
 
-    // send back a pong
-    status_packet_pong_t pong = {
-        .time = packet->time
-    };
-    CHECK_AND_RETHROW(send_status_packet_pong(client, &pong));
+    free(m_favicon);
+    m_favicon = favicon;
+    atomic_fetch_add_explicit(&m_status_generation, 1, memory_order_release);
 
 cleanup:
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(data);
     return err;
 }
 
-// TODO: something proper
-static char m_server_info[] =
-        "{"
-        "\"version\":{"
-        "\"name\":\"1.18.1\","
-        "\"protocol\":757"
-        "},"
-        "\"description\": {"
-        "\"text\":\"Hello World!\""
-        "}"
-        "}";
-
-err_t process_status_packet_ping_start(tick_arena_t* arena, client_t* client, status_packet_ping_start_t* packet) {
+void status_set_online_players(int online) {
+    if (atomic_exchange_explicit(&m_online_players, online, memory_order_relaxed) != online) {
+        atomic_store_explicit(&m_status_changed, true, memory_order_relaxed);
+    }
+}
+
+void status_tick() {
+    if (atomic_exchange_explicit(&m_status_changed, false, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&m_status_generation, 1, memory_order_release);
+    }
+}
+
+/**
+ * Encode the status response of this reactor again
+ */
+static err_t refresh_status_response(size_t generation) {
     err_t err = NO_ERROR;
 
-    status_packet_server_info_t server_info = {
-        .response = {
-            .elements = m_server_info,
-            .length = ARRAY_LEN(m_server_info)
+    // format the json, the favicon is the bulk of it so make sure it fits
+    int online = atomic_load_explicit(&m_online_players, memory_order_relaxed);
+    int json_len = 0;
+    while (true) {
+        json_len = snprintf(m_status_response.json, m_status_response.json_capacity,
+                            "{"
+                                "\"version\":{\"name\":\"" VERSION_NAME "\",\"protocol\":%d},"
+                                "\"players\":{\"max\":%d,\"online\":%d},"
+                                "\"description\":{\"text\":\"Hello World!\"}"
+                                "%s%s%s"
+                            "}",
+                            PROTOCOL_VERSION,
+                            g_server_config.max_connections, online,
+                            m_favicon != NULL ? ",\"favicon\":\"" : "",
+                            m_favicon != NULL ? m_favicon : "",
+                            m_favicon != NULL ? "\"" : "");
+        CHECK(json_len >= 0);
+        if (json_len < m_status_response.json_capacity) {
+            break;
         }
-    };
-    CHECK_AND_RETHROW(send_status_packet_server_info(client, &server_info));
+
+        m_status_response.json_capacity = json_len + 1;
+        char* json = realloc(m_status_response.json, m_status_response.json_capacity);
+        CHECK_ERRNO(json != NULL);
+        m_status_response.json = json;
+    }
+
+    // frame it as a server info packet: length, packet id, string length, string
+    int string_length_len = protocol_varint_size(json_len);
+    int packet_len = 1 + string_length_len + json_len;
+    int length_len = protocol_varint_size(packet_len);
+
+    size_t frame_size = length_len + packet_len;
+    if (frame_size > m_status_response.frame_capacity) {
+        uint8_t* frame = realloc(m_status_response.frame, frame_size);
+        CHECK_ERRNO(frame != NULL);
+        m_status_response.frame = frame;
+        m_status_response.frame_capacity = frame_size;
+    }
+
+    uint8_t* out = m_status_response.frame;
+    out += protocol_write_varint(out, length_len, packet_len);
+    *out++ = 0x00;
+    out += protocol_write_varint(out, string_length_len, json_len);
+    memcpy(out, m_status_response.json, json_len);
+
+    m_status_response.frame_size = frame_size;
+    m_status_response.generation = generation;
+
+cleanup:
+    return err;
+}
+
+err_t process_status_packet_ping(client_t* client, status_packet_ping_t* packet) {
+    err_t err = NO_ERROR;
+
+    // the pong is fixed size, so frame it right here
+    uint8_t pong[10] = { 9, 0x01 };
+    protocol_write_i64(pong + 2, packet->time);
+    CHECK_AND_RETHROW(server_send_frame(client, pong, sizeof(pong)));
 
 cleanup:
     return err;
 }
 
+err_t process_status_packet_ping_start(client_t* client, status_packet_ping_start_t* packet) {
+    err_t err = NO_ERROR;
+
+    // server list floods are turned away without a response
+    if (!admission_allow_status(client->address.sin_addr.s_addr)) {
+        server_disconnect(client);
+        goto cleanup;
+    }
+
+    // only encode the response again if the status changed
+    size_t generation = atomic_load_explicit(&m_status_generation, memory_order_acquire);
+    if (m_status_response.generation != generation) {
+        CHECK_AND_RETHROW(refresh_status_response(generation));
+    }
+
+    CHECK_AND_RETHROW(server_send_frame(client, m_status_response.frame, m_status_response.frame_size));
+
+cleanup:
+    return err;
+}
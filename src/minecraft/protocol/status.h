@@ -0,0 +1,24 @@
+#pragma once
+
+#include <lib/except.h>
+
+/**
+ * Load the server icon shown in the server list, this should be a 64x64 png
+ *
+ * @param path  [IN] The path of the icon
+ */
+err_t status_load_favicon(const char* path);
+
+/**
+ * Set the amount of players shown in the server list, the status
+ * response only picks it up on the next status_tick
+ *
+ * @param online    [IN] The amount of players online
+ */
+void status_set_online_players(int online);
+
+/**
+ * Called by the game loop once per tick, if anything in the status changed
+ * the reactors will re-encode their cached status response on the next ping
+ */
+void status_tick();
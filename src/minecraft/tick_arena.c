@@ -31,12 +31,18 @@ static tick_arena_t* m_next_tick_arena;
  * We are going to allocate a constant size of 1GB for the whole arena, should
  * be far more than enough
  *
- * @param arena [IN] The arena
+ * @param arena         [IN] The arena
+ * @param huge_pages    [IN] Should the arena be mapped with huge pages
  */
-static err_t init_arena(tick_arena_t* arena) {
+static err_t init_arena(tick_arena_t* arena, bool huge_pages) {
     err_t err = NO_ERROR;
 
-    arena->start = mmap(NULL, SIZE_1GB, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (huge_pages) {
+        arena->start = huge_pages_map(SIZE_1GB, &arena->pages);
+    } else {
+        arena->start = mmap(NULL, SIZE_1GB, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        arena->pages = HUGE_PAGES_NONE;
+    }
     CHECK_ERRNO(arena->start != MAP_FAILED);
 
     arena->max_size = SIZE_1GB;
@@ -45,14 +51,17 @@ cleanup:
     return err;
 }
 
-err_t init_tick_arenas() {
+err_t init_tick_arenas(bool huge_pages) {
     err_t err = NO_ERROR;
 
     TRACE("Initializing packet arenas");
 
     // init our two arenas
-    CHECK_AND_RETHROW(init_arena(&m_arena_1));
-    CHECK_AND_RETHROW(init_arena(&m_arena_2));
+    CHECK_AND_RETHROW(init_arena(&m_arena_1, huge_pages));
+    CHECK_AND_RETHROW(init_arena(&m_arena_2, huge_pages));
+    if (huge_pages && m_arena_1.pages != HUGE_PAGES_HUGETLB) {
+        TRACE("Not enough reserved huge pages for the arenas, using transparent huge pages");
+    }
 
     // assign them
     m_current_tick_arena = &m_arena_1;
@@ -73,8 +82,9 @@ cleanup:
 static void reset_arena(tick_arena_t* arena) {
     if (arena->current_offset < arena->last_offset && arena->last_offset - arena->current_offset > SIZE_2MB) {
         // we are gonna tell the kernel we don't need the memory that is allocated above the allocation space because it
-        // means we don't need it this frame
-        madvise((void*)ALIGN_UP((uintptr_t)arena->start + arena->current_offset, PAGE_SIZE), ALIGN_DOWN(arena->last_offset - arena->current_offset, PAGE_SIZE), MADV_FREE);
+        // means we don't need it this frame, with huge pages only the huge pages that are entirely unused are given
+        // back so none of them gets split
+        huge_pages_release(arena->start + arena->current_offset, arena->last_offset - arena->current_offset, arena->pages);
     }
 
     // now reset it
@@ -91,17 +101,19 @@ tick_arena_t* switch_tick_arenas() {
     m_next_tick_arena = m_current_tick_arena;
     m_current_tick_arena = next_tick_arena;
 
-    // reset the arena for the new allocations
-    reset_arena(m_next_tick_arena);
-
     // leave it
     ticket_lock_leave(&m_arena_lock);
 
-    // now we need to wait until everyone is done using the old arena
-    while (atomic_load_explicit(&m_current_tick_arena->users, memory_order_consume) != 0) {
+    // now we need to wait until everyone is done using the old arena, once they
+    // are all the packets in it are complete and the game tick can read them
+    while (atomic_load_explicit(&m_next_tick_arena->users, memory_order_acquire) != 0) {
         __builtin_ia32_pause();
     }
 
+    // reset the old arena, its data stays intact until it is
+    // allocated from again once the arenas switch back
+    reset_arena(m_next_tick_arena);
+
     // return the arena for the current tick
     return m_current_tick_arena;
 }
@@ -109,13 +121,13 @@ tick_arena_t* switch_tick_arenas() {
 tick_arena_t* get_tick_arena() {
     ticket_lock_enter(&m_arena_lock);
     tick_arena_t* arena = m_current_tick_arena;
-    arena->users++;
+    atomic_fetch_add_explicit(&arena->users, 1, memory_order_relaxed);
     ticket_lock_leave(&m_arena_lock);
     return arena;
 }
 
 void return_tick_arena(tick_arena_t* arena) {
-    atomic_fetch_add_explicit(&m_current_tick_arena->users, -1, memory_order_release);
+    atomic_fetch_add_explicit(&arena->users, -1, memory_order_release);
 }
 
 void* tick_arena_alloc_unlocked(tick_arena_t* arena, size_t size) {
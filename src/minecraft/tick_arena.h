@@ -4,6 +4,7 @@
 #include <stdalign.h>
 #include <stdint.h>
 #include <sync/spin_lock.h>
+#include <lib/huge_pages.h>
 #include <lib/except.h>
 
 typedef struct tick_arena {
@@ -13,6 +14,10 @@ typedef struct tick_arena {
     size_t max_size;
     size_t last_offset;
 
+    // the pages the arena is mapped with, unused memory
+    // is given back a page at a time
+    huge_page_kind_t pages;
+
     // allocation lock
     spin_lock_t lock;
 
@@ -24,12 +29,18 @@ typedef struct tick_arena {
 
 /**
  * Initialize the packet arenas
+ *
+ * @param huge_pages    [IN] Map the arenas with huge pages, this way bump allocating
+ *                           across the arena does not miss the TLB all the time
  */
-err_t init_tick_arenas();
+err_t init_tick_arenas(bool huge_pages);
 
 /**
  * Switch between the arenas, done once a game tick
  *
+ * Once this returns no one is allocating from the arena of the last tick anymore,
+ * and what was allocated in it stays valid until the end of the current tick
+ *
  * Returns the arena to use for the current game tick
  */
 tick_arena_t* switch_tick_arenas();
@@ -0,0 +1,149 @@
+#include "admission.h"
+#include "server.h"
+
+#include <sys/random.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/**
+ * The amount of per address slots, must be a power of two. Addresses are
+ * hashed into them and addresses that collide share their limits, which
+ * only ever makes the limit stricter for them
+ */
+#define ADMISSION_ADDRESS_SLOTS_BITS    16
+#define ADMISSION_ADDRESS_SLOTS         (1 << ADMISSION_ADDRESS_SLOTS_BITS)
+
+/**
+ * A token bucket kept as the time at which it is going to be full again (the
+ * generic cell rate algorithm), so it is a single word that can be updated
+ * with a compare and swap instead of under a lock. 0 is a full bucket
+ */
+typedef atomic_uint_fast64_t token_bucket_t;
+
+typedef struct bucket_limit {
+    // the time a single token takes to come back, 0 means no limit
+    uint64_t interval;
+
+    // how far ahead of now the bucket can be before it runs out,
+    // the burst times the interval
+    uint64_t tolerance;
+} bucket_limit_t;
+
+typedef struct address_slot {
+    token_bucket_t connections;
+    token_bucket_t status;
+} address_slot_t;
+
+/**
+ * The limits, taken from the server config
+ */
+static bucket_limit_t m_connection_limit;
+static bucket_limit_t m_connection_limit_per_address;
+static bucket_limit_t m_status_limit;
+static bucket_limit_t m_status_limit_per_address;
+
+/**
+ * The global buckets and the buckets of the addresses, shared by all the
+ * reactors. The slots are never added or removed, an address that was idle
+ * long enough behaves exactly like one we have never seen
+ */
+static token_bucket_t m_connection_bucket;
+static token_bucket_t m_status_bucket;
+static address_slot_t m_addresses[ADMISSION_ADDRESS_SLOTS];
+
+/**
+ * Random key for hashing the addresses, so the collisions can't be picked
+ */
+static uint64_t m_hash_key;
+
+static uint64_t get_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bucket_limit_t make_limit(int rate, int burst) {
+    if (rate == 0) {
+        return (bucket_limit_t){ 0 };
+    }
+
+    uint64_t interval = 1000000000ull / rate;
+    return (bucket_limit_t){
+        .interval = interval > 0 ? interval : 1,
+        .tolerance = (uint64_t)(burst > 0 ? burst : 1) * (interval > 0 ? interval : 1),
+    };
+}
+
+/**
+ * Try to take a token from the bucket
+ */
+static bool take_token(token_bucket_t* bucket, bucket_limit_t* limit, uint64_t now) {
+    if (limit->interval == 0) {
+        return true;
+    }
+
+    uint64_t full_at = atomic_load_explicit(bucket, memory_order_relaxed);
+    uint64_t new_full_at;
+    do {
+        // taking a token pushes the time it is full again by a single interval
+        new_full_at = (full_at > now ? full_at : now) + limit->interval;
+        if (new_full_at - now > limit->tolerance) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(bucket, &full_at, new_full_at,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
+
+/**
+ * Get the slot of the address
+ */
+static address_slot_t* get_address(uint32_t address) {
+    uint64_t hash = ((uint64_t)address ^ m_hash_key) * 0x9E3779B97F4A7C15ull;
+    return &m_addresses[hash >> (64 - ADMISSION_ADDRESS_SLOTS_BITS)];
+}
+
+err_t init_admission() {
+    err_t err = NO_ERROR;
+
+    CHECK(g_server_config.connection_rate >= 0 && g_server_config.connection_rate_per_address >= 0);
+    CHECK(g_server_config.status_rate >= 0 && g_server_config.status_rate_per_address >= 0);
+
+    m_connection_limit = make_limit(g_server_config.connection_rate, g_server_config.connection_burst);
+    m_connection_limit_per_address = make_limit(g_server_config.connection_rate_per_address, g_server_config.connection_burst_per_address);
+    m_status_limit = make_limit(g_server_config.status_rate, g_server_config.status_burst);
+    m_status_limit_per_address = make_limit(g_server_config.status_rate_per_address, g_server_config.status_burst_per_address);
+
+    if (getrandom(&m_hash_key, sizeof(m_hash_key), 0) != sizeof(m_hash_key)) {
+        // still spreads the addresses, they are just easier to guess
+        WARN("Failed to get a random address hash key");
+        m_hash_key = get_time_ns();
+    }
+
+cleanup:
+    return err;
+}
+
+bool admission_allow_connection(uint32_t address) {
+    uint64_t now = get_time_ns();
+
+    // check the address first, so a single address going over
+    // its limit does not eat from the global limit
+    address_slot_t* slot = get_address(address);
+    if (!take_token(&slot->connections, &m_connection_limit_per_address, now)) {
+        return false;
+    }
+    return take_token(&m_connection_bucket, &m_connection_limit, now);
+}
+
+bool admission_allow_status(uint32_t address) {
+    uint64_t now = get_time_ns();
+
+    // check the address first, so a single address going over
+    // its limit does not eat from the global limit
+    address_slot_t* slot = get_address(address);
+    if (!take_token(&slot->status, &m_status_limit_per_address, now)) {
+        return false;
+    }
+    return take_token(&m_status_bucket, &m_status_limit, now);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <lib/except.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Token bucket rate limits for new connections and status requests, both globally
+ * and per address. These are checked before we spend anything on the connection so
+ * a flood of pings or bot joins is turned away as cheaply as possible
+ */
+
+/**
+ * Setup the admission limits from the server config
+ */
+err_t init_admission();
+
+/**
+ * Check if a new connection from the given address should be accepted
+ *
+ * @param address   [IN] The ipv4 address of the peer, in network order
+ */
+bool admission_allow_connection(uint32_t address);
+
+/**
+ * Check if a status request from the given address should be answered
+ *
+ * @param address   [IN] The ipv4 address of the peer, in network order
+ */
+bool admission_allow_status(uint32_t address);
@@ -0,0 +1,238 @@
+#include "aes_cfb8.h"
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Portable AES
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const uint8_t m_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static uint8_t xtime(uint8_t x) {
+    return (x << 1) ^ ((x & 0x80) ? 0x1b : 0x00);
+}
+
+static void expand_key(uint8_t round_keys[11][16], const uint8_t key[16]) {
+    static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+    memcpy(round_keys[0], key, 16);
+    for (int round = 1; round <= 10; round++) {
+        uint8_t* prev = round_keys[round - 1];
+        uint8_t* next = round_keys[round];
+
+        // rotate, substitute and add the round constant to the last word
+        uint8_t temp[4] = {
+            m_sbox[prev[13]] ^ rcon[round - 1],
+            m_sbox[prev[14]],
+            m_sbox[prev[15]],
+            m_sbox[prev[12]],
+        };
+        for (int i = 0; i < 16; i++) {
+            next[i] = prev[i] ^ (i < 4 ? temp[i] : next[i - 4]);
+        }
+    }
+}
+
+static void encrypt_block(const uint8_t round_keys[11][16], const uint8_t in[16], uint8_t out[16]) {
+    uint8_t state[16];
+    for (int i = 0; i < 16; i++) {
+        state[i] = in[i] ^ round_keys[0][i];
+    }
+
+    for (int round = 1; round <= 10; round++) {
+        // sub bytes and shift rows, the state is column major
+        uint8_t temp[16];
+        for (int i = 0; i < 16; i++) {
+            temp[i] = m_sbox[state[(i + 4 * (i % 4)) % 16]];
+        }
+
+        // mix columns, skipped in the last round
+        if (round != 10) {
+            for (int c = 0; c < 4; c++) {
+                uint8_t* col = &temp[c * 4];
+                uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+                uint8_t first = col[0];
+                col[0] ^= all ^ xtime(col[0] ^ col[1]);
+                col[1] ^= all ^ xtime(col[1] ^ col[2]);
+                col[2] ^= all ^ xtime(col[2] ^ col[3]);
+                col[3] ^= all ^ xtime(col[3] ^ first);
+            }
+        }
+
+        for (int i = 0; i < 16; i++) {
+            state[i] = temp[i] ^ round_keys[round][i];
+        }
+    }
+
+    memcpy(out, state, 16);
+}
+
+static void encrypt_portable(aes_cfb8_t* cipher, uint8_t* data, size_t len) {
+    uint8_t block[16];
+    for (size_t i = 0; i < len; i++) {
+        encrypt_block(cipher->round_keys, cipher->iv, block);
+        data[i] ^= block[0];
+        memmove(cipher->iv, cipher->iv + 1, 15);
+        cipher->iv[15] = data[i];
+    }
+}
+
+static void decrypt_portable(aes_cfb8_t* cipher, uint8_t* data, size_t len) {
+    uint8_t block[16];
+    for (size_t i = 0; i < len; i++) {
+        encrypt_block(cipher->round_keys, cipher->iv, block);
+        uint8_t ciphertext = data[i];
+        data[i] ^= block[0];
+        memmove(cipher->iv, cipher->iv + 1, 15);
+        cipher->iv[15] = ciphertext;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// AES-NI
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define AESNI __attribute__((target("aes,ssse3")))
+
+static AESNI __m128i aesni_encrypt(const __m128i* keys, __m128i block) {
+    block = _mm_xor_si128(block, keys[0]);
+    #pragma GCC unroll 9
+    for (int round = 1; round < 10; round++) {
+        block = _mm_aesenc_si128(block, keys[round]);
+    }
+    return _mm_aesenclast_si128(block, keys[10]);
+}
+
+static AESNI void encrypt_aesni(aes_cfb8_t* cipher, uint8_t* data, size_t len) {
+    __m128i keys[11];
+    for (int i = 0; i < 11; i++) {
+        keys[i] = _mm_load_si128((__m128i*)cipher->round_keys[i]);
+    }
+
+    // every byte depends on the one before it, so this is bound
+    // by the latency of a full AES block per byte
+    __m128i iv = _mm_load_si128((__m128i*)cipher->iv);
+    for (size_t i = 0; i < len; i++) {
+        __m128i block = aesni_encrypt(keys, iv);
+        data[i] ^= (uint8_t)_mm_cvtsi128_si32(block);
+        iv = _mm_or_si128(_mm_srli_si128(iv, 1), _mm_slli_si128(_mm_cvtsi32_si128(data[i]), 15));
+    }
+    _mm_store_si128((__m128i*)cipher->iv, iv);
+}
+
+/**
+ * Decryption only needs ciphertext for the shift register, which we already have,
+ * so 8 bytes are done at once and their AES rounds are interleaved
+ */
+static AESNI void decrypt_aesni(aes_cfb8_t* cipher, uint8_t* data, size_t len) {
+    __m128i keys[11];
+    for (int i = 0; i < 11; i++) {
+        keys[i] = _mm_load_si128((__m128i*)cipher->round_keys[i]);
+    }
+
+    __m128i iv = _mm_load_si128((__m128i*)cipher->iv);
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        // the shift register of every byte is a window over the iv followed
+        // by the ciphertext of this batch
+        __m128i ciphertext = _mm_loadl_epi64((__m128i*)(data + i));
+        __m128i blocks[8] = {
+            iv,
+            _mm_alignr_epi8(ciphertext, iv, 1),
+            _mm_alignr_epi8(ciphertext, iv, 2),
+            _mm_alignr_epi8(ciphertext, iv, 3),
+            _mm_alignr_epi8(ciphertext, iv, 4),
+            _mm_alignr_epi8(ciphertext, iv, 5),
+            _mm_alignr_epi8(ciphertext, iv, 6),
+            _mm_alignr_epi8(ciphertext, iv, 7),
+        };
+
+        // keep the whole batch in registers
+        #pragma GCC unroll 8
+        for (int j = 0; j < 8; j++) {
+            blocks[j] = _mm_xor_si128(blocks[j], keys[0]);
+        }
+        for (int round = 1; round < 10; round++) {
+            #pragma GCC unroll 8
+            for (int j = 0; j < 8; j++) {
+                blocks[j] = _mm_aesenc_si128(blocks[j], keys[round]);
+            }
+        }
+        uint64_t keystream = 0;
+        #pragma GCC unroll 8
+        for (int j = 0; j < 8; j++) {
+            blocks[j] = _mm_aesenclast_si128(blocks[j], keys[10]);
+            keystream |= (uint64_t)(uint8_t)_mm_cvtsi128_si32(blocks[j]) << (j * 8);
+        }
+
+        uint64_t plaintext = (uint64_t)_mm_cvtsi128_si64(ciphertext) ^ keystream;
+        memcpy(data + i, &plaintext, sizeof(plaintext));
+        iv = _mm_alignr_epi8(ciphertext, iv, 8);
+    }
+
+    // the tail, one byte at a time
+    for (; i < len; i++) {
+        __m128i block = aesni_encrypt(keys, iv);
+        uint8_t ciphertext = data[i];
+        data[i] ^= (uint8_t)_mm_cvtsi128_si32(block);
+        iv = _mm_or_si128(_mm_srli_si128(iv, 1), _mm_slli_si128(_mm_cvtsi32_si128(ciphertext), 15));
+    }
+
+    _mm_store_si128((__m128i*)cipher->iv, iv);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool m_use_aesni = true;
+
+void aes_cfb8_use_aesni(int enabled) {
+    m_use_aesni = enabled;
+}
+
+static bool has_aesni() {
+    return m_use_aesni && __builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3");
+}
+
+void aes_cfb8_init(aes_cfb8_t* cipher, const uint8_t key[16], const uint8_t iv[16]) {
+    // the AES-NI key expansion gives the same schedule, it is
+    // done once per connection so no reason to special case it
+    expand_key(cipher->round_keys, key);
+    memcpy(cipher->iv, iv, 16);
+}
+
+void aes_cfb8_encrypt(aes_cfb8_t* cipher, uint8_t* data, size_t len) {
+    if (has_aesni()) {
+        encrypt_aesni(cipher, data, len);
+    } else {
+        encrypt_portable(cipher, data, len);
+    }
+}
+
+void aes_cfb8_decrypt(aes_cfb8_t* cipher, uint8_t* data, size_t len) {
+    if (has_aesni()) {
+        decrypt_aesni(cipher, data, len);
+    } else {
+        decrypt_portable(cipher, data, len);
+    }
+}
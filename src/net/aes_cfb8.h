@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdalign.h>
+
+/**
+ * AES-128 in CFB8 mode, which is what the minecraft protocol encrypts the stream
+ * with. CFB8 needs a full AES block per byte, so this uses AES-NI when the cpu
+ * has it and a (slow) portable implementation otherwise.
+ *
+ * Both directions only ever use the AES encryption, and work in place.
+ */
+typedef struct aes_cfb8 {
+    // the expanded key
+    alignas(16) uint8_t round_keys[11][16];
+
+    // the shift register, the last 16 bytes of ciphertext
+    alignas(16) uint8_t iv[16];
+} aes_cfb8_t;
+
+/**
+ * Setup the cipher
+ *
+ * @param cipher    [IN] The cipher
+ * @param key       [IN] The 128bit key
+ * @param iv        [IN] The initial 16 bytes of the shift register
+ */
+void aes_cfb8_init(aes_cfb8_t* cipher, const uint8_t key[16], const uint8_t iv[16]);
+
+/**
+ * Encrypt data in place
+ *
+ * @param cipher    [IN] The cipher
+ * @param data      [IN] The data to encrypt
+ * @param len       [IN] The length of the data
+ */
+void aes_cfb8_encrypt(aes_cfb8_t* cipher, uint8_t* data, size_t len);
+
+/**
+ * Decrypt data in place
+ *
+ * @param cipher    [IN] The cipher
+ * @param data      [IN] The data to decrypt
+ * @param len       [IN] The length of the data
+ */
+void aes_cfb8_decrypt(aes_cfb8_t* cipher, uint8_t* data, size_t len);
+
+/**
+ * Force the portable implementation, for benchmarking
+ *
+ * @param enabled   [IN] Should AES-NI be used if available
+ */
+void aes_cfb8_use_aesni(int enabled);
@@ -2,125 +2,626 @@
 
 #include "server.h"
 
-#include <lib/stb_ds.h>
+#include <sync/spin_lock.h>
+#include <lib/huge_pages.h>
+#include <lib/defs.h>
 
+#include <sys/sysinfo.h>
 #include <sys/mman.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <stdlib.h>
 #include <stddef.h>
-#include <sync/spin_lock.h>
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Every class has its own range of address space, its buffers are carved from the start of the range so the class
+// of a buffer is known from its address alone. Threads keep free buffers in magazines of their own and only go to
+// the depot of the class (which is locked) to swap a whole magazine, so most allocations touch no shared state.
+// Free buffers are never given back to the kernel on the way, the trimmer does that in the background once there is
+// memory pressure.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The size of the address range of every class
+ */
+#define CLASS_RESERVE_SHIFT 34
+
+/**
+ * Classes grow by committing this much of their range at a time, or
+ * a single buffer for classes larger than it
+ */
+#define CLASS_CHUNK_SIZE SIZE_2MB
+
+/**
+ * Classes with buffers at least this large are backed by transparent huge pages
+ * when huge pages are enabled, their chunks are always whole huge pages
+ */
+#define CLASS_HUGE_MIN_SIZE SIZE_64KB
+
+/**
+ * A magazine holds about this many bytes worth of buffers, and no
+ * more than the max rounds
+ */
+#define MAGAZINE_BYTES SIZE_256KB
+#define MAGAZINE_MAX_ROUNDS 32
+
+/**
+ * How often the trimmer looks at the depots, in milliseconds
+ */
+#define TRIM_INTERVAL_MS 1000
+
+/**
+ * The system is low on memory once less than this fraction of it is free
+ */
+#define LOW_MEMORY_FRACTION 32
+
+/**
+ * The registered send buffers are a class of their own, right after the real classes
+ */
+#define REGISTERED_CLASS BUFFER_POOL_CLASS_COUNT
+
+/**
+ * A stack of free buffers of a class
+ */
+typedef struct magazine {
+    struct magazine* next;
+    int count;
+    void* rounds[];
+} magazine_t;
+
+/**
+ * A free buffer that could not be put in a magazine (there was no
+ * memory for a new one), it is linked through its own memory
+ */
 typedef struct free_buffer {
     struct free_buffer* next;
 } free_buffer_t;
 
+typedef struct size_class {
+    // the size of the buffers and how many fit in a magazine
+    size_t size;
+    int rounds;
+
+    // the reserved range of the class, it is committed up to committed
+    // and new buffers are carved from carve
+    uint8_t* base;
+    uint8_t* carve;
+    uint8_t* committed;
+    uint8_t* end;
+
+    // a fixed class never grows and is never trimmed
+    bool fixed;
+
+    // are the chunks of the class backed by huge pages
+    bool huge_pages;
+
+    // the depot, threads only come here to swap whole magazines
+    spin_lock_t lock;
+    magazine_t* full;
+    magazine_t* trimmed;
+    magazine_t* empty;
+    free_buffer_t* loose;
+    size_t full_count;
+
+    // the buffers in the full magazines, a magazine is
+    // not always full when it is put in the depot
+    size_t full_buffers;
+
+    // the least full magazines the depot had since the last trim, this
+    // many were not needed for the whole interval
+    size_t full_low;
+
+    // the amount of free buffers in the depot, only changed with
+    // the lock held but can be read without it
+    atomic_size_t free_count;
+
+    // stats, the sizes are in buffers
+    uint64_t hits;
+    uint64_t misses;
+    size_t carved;
+    size_t trimmed_count;
+} size_class_t;
+
+/**
+ * The magazines a thread has for a class, allocations come out of the loaded one
+ * and the previous one is kept so a thread going back and forth around a magazine
+ * boundary does not go to the depot every time
+ */
+typedef struct thread_cache {
+    magazine_t* loaded;
+    magazine_t* previous;
+    uint64_t hits;
+} thread_cache_t;
+
+static size_class_t m_classes[BUFFER_POOL_CLASS_COUNT + 1];
+
+static thread_local thread_cache_t m_caches[BUFFER_POOL_CLASS_COUNT + 1];
+
+/**
+ * The start of the reserved range, the range of class N starts N << CLASS_RESERVE_SHIFT after it
+ */
+static uint8_t* m_reserved = NULL;
+
+/**
+ * The class send buffers come from once the registered ones are all in use
+ */
+static int m_send_class;
+
+static thrd_t m_trimmer_thread;
+
+static int size_to_class(size_t size) {
+    if (size <= BUFFER_POOL_MIN_SIZE) {
+        return 0;
+    }
+    return (64 - __builtin_clzll(size - 1)) - __builtin_ctz(BUFFER_POOL_MIN_SIZE);
+}
+
+static int buffer_to_class(void* buffer) {
+    return ((uint8_t*)buffer - m_reserved) >> CLASS_RESERVE_SHIFT;
+}
+
+static magazine_t* new_magazine(size_class_t* class) {
+    magazine_t* magazine = malloc(sizeof(magazine_t) + class->rounds * sizeof(void*));
+    if (magazine != NULL) {
+        magazine->next = NULL;
+        magazine->count = 0;
+    }
+    return magazine;
+}
+
+/**
+ * Give the thread its magazines for the class, done on the first use
+ */
+static bool setup_cache(size_class_t* class, thread_cache_t* cache) {
+    cache->loaded = new_magazine(class);
+    cache->previous = new_magazine(class);
+    if (cache->loaded == NULL || cache->previous == NULL) {
+        SAFE_FREE(cache->loaded);
+        SAFE_FREE(cache->previous);
+        return false;
+    }
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Recv is only done at a single path, so this can be lockless
+// The depot, everything here is called with the lock of the class held
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void** m_protocol_recv_buffers = NULL;
+/**
+ * Commit the next chunk of the range of the class
+ */
+static bool class_grow(size_class_t* class) {
+    size_t chunk = class->size > CLASS_CHUNK_SIZE ? class->size : CLASS_CHUNK_SIZE;
+    if (class->fixed || class->committed + chunk > class->end) {
+        return false;
+    }
+    if (mprotect(class->committed, chunk, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    if (class->huge_pages) {
+        huge_pages_advise(class->committed, chunk);
+    }
+    class->committed += chunk;
+    return true;
+}
+
+/**
+ * Carve new buffers into the magazine, until it is full or the class can't grow
+ */
+static void class_carve(size_class_t* class, magazine_t* magazine) {
+    while (magazine->count < class->rounds) {
+        if (class->carve == class->committed && !class_grow(class)) {
+            break;
+        }
+        magazine->rounds[magazine->count++] = class->carve;
+        class->carve += class->size;
+        class->carved++;
+    }
+}
+
+static void depot_put_full(size_class_t* class, magazine_t* magazine) {
+    magazine->next = class->full;
+    class->full = magazine;
+    class->full_count++;
+    class->full_buffers += magazine->count;
+    atomic_fetch_add_explicit(&class->free_count, magazine->count, memory_order_relaxed);
+}
 
-void* buffer_pool_get_protocol_recv() {
-    if (arrlen(m_protocol_recv_buffers) == 0) {
-        // we have no free mappings, just allocate a new one
-        void* ptr = mmap(NULL, g_server_config.max_recv_packet_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (ptr == MAP_FAILED) {
+/**
+ * Take a full magazine, resident ones are preferred over trimmed ones
+ */
+static magazine_t* depot_take_full(size_class_t* class) {
+    magazine_t* magazine = class->full;
+    if (magazine != NULL) {
+        class->full = magazine->next;
+        class->full_count--;
+        class->full_buffers -= magazine->count;
+        if (class->full_count < class->full_low) {
+            class->full_low = class->full_count;
+        }
+    } else {
+        magazine = class->trimmed;
+        if (magazine == NULL) {
             return NULL;
-        } else {
-            return ptr;
         }
+        class->trimmed = magazine->next;
+        class->trimmed_count -= magazine->count;
     }
+    atomic_fetch_sub_explicit(&class->free_count, magazine->count, memory_order_relaxed);
+    return magazine;
+}
 
-    // we have a mapping free already, reuse it
-    void* buffer = arrpop(m_protocol_recv_buffers);
+static void depot_put_empty(size_class_t* class, magazine_t* magazine) {
+    magazine->next = class->empty;
+    class->empty = magazine;
+}
 
-    // tell the kernel we are going to use this very soon, so prepare
-    // the page range
-    madvise(buffer, g_server_config.max_recv_packet_size, MADV_WILLNEED);
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Allocation
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void* class_alloc_slow(size_class_t* class, thread_cache_t* cache) {
+    // a fixed class that ran out has nothing to carve either, so
+    // don't take the lock just to find that out
+    if (class->fixed && atomic_load_explicit(&class->free_count, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    if (cache->loaded == NULL && !setup_cache(class, cache)) {
+        return NULL;
+    }
+
+    spin_lock_enter(&class->lock);
+    class->hits += cache->hits;
+    cache->hits = 0;
+    class->misses++;
+
+    magazine_t* full = depot_take_full(class);
+    if (full != NULL) {
+        // both magazines are empty, trade the previous one for the full one
+        depot_put_empty(class, cache->previous);
+        cache->previous = cache->loaded;
+        cache->loaded = full;
+    } else {
+        // the depot is empty, take whatever was left on the side
+        // and carve new buffers if there is nothing there either
+        magazine_t* loaded = cache->loaded;
+        while (class->loose != NULL && loaded->count < class->rounds) {
+            loaded->rounds[loaded->count++] = class->loose;
+            class->loose = class->loose->next;
+            atomic_fetch_sub_explicit(&class->free_count, 1, memory_order_relaxed);
+        }
+        if (loaded->count == 0) {
+            class_carve(class, loaded);
+        }
+    }
+
+    void* buffer = NULL;
+    if (cache->loaded->count > 0) {
+        buffer = cache->loaded->rounds[--cache->loaded->count];
+    }
+
+    spin_lock_leave(&class->lock);
 
     return buffer;
 }
 
-void buffer_pool_return_protocol_recv(void* buffer) {
-    // just queue it
-    arrpush(m_protocol_recv_buffers, buffer);
+static void* class_alloc(size_class_t* class, thread_cache_t* cache) {
+    magazine_t* loaded = cache->loaded;
+    if (loaded != NULL) {
+        if (loaded->count == 0 && cache->previous->count > 0) {
+            // the previous one still has buffers, use it first
+            cache->loaded = cache->previous;
+            cache->previous = loaded;
+            loaded = cache->loaded;
+        }
+
+        if (loaded->count > 0) {
+            cache->hits++;
+            return loaded->rounds[--loaded->count];
+        }
+    }
 
-    // tell the kernel we are no longer using this page range and it can
-    // free it should there be memory preasure
-    madvise(buffer, g_server_config.max_recv_packet_size, MADV_FREE);
+    return class_alloc_slow(class, cache);
+}
+
+static void class_free_slow(size_class_t* class, thread_cache_t* cache, void* buffer) {
+    if (cache->loaded == NULL && setup_cache(class, cache)) {
+        cache->loaded->rounds[cache->loaded->count++] = buffer;
+        return;
+    }
+
+    spin_lock_enter(&class->lock);
+
+    // both magazines are full (or the thread has none), get an empty one
+    magazine_t* empty = class->empty;
+    if (empty != NULL) {
+        class->empty = empty->next;
+    } else {
+        spin_lock_leave(&class->lock);
+        empty = new_magazine(class);
+        spin_lock_enter(&class->lock);
+    }
+
+    class->hits += cache->hits;
+    cache->hits = 0;
+
+    if (empty == NULL || cache->loaded == NULL) {
+        // no memory for magazines, keep it on the side
+        free_buffer_t* free_buffer = buffer;
+        free_buffer->next = class->loose;
+        class->loose = free_buffer;
+        atomic_fetch_add_explicit(&class->free_count, 1, memory_order_relaxed);
+        if (empty != NULL) {
+            depot_put_empty(class, empty);
+        }
+    } else {
+        // give the previous one to the depot and start filling the empty one
+        depot_put_full(class, cache->previous);
+        cache->previous = cache->loaded;
+        cache->loaded = empty;
+        empty->rounds[empty->count++] = buffer;
+    }
+
+    spin_lock_leave(&class->lock);
+}
+
+static void class_free(size_class_t* class, thread_cache_t* cache, void* buffer) {
+    magazine_t* loaded = cache->loaded;
+    if (loaded != NULL) {
+        if (loaded->count == class->rounds && cache->previous->count < class->rounds) {
+            // the previous one still has room, use it first
+            cache->loaded = cache->previous;
+            cache->previous = loaded;
+            loaded = cache->loaded;
+        }
+
+        if (loaded->count < class->rounds) {
+            loaded->rounds[loaded->count++] = buffer;
+            return;
+        }
+    }
+
+    class_free_slow(class, cache, buffer);
+}
+
+void* buffer_pool_alloc(size_t size) {
+    if (m_reserved == NULL || size > BUFFER_POOL_MAX_SIZE) {
+        return NULL;
+    }
+
+    int index = size_to_class(size);
+    return class_alloc(&m_classes[index], &m_caches[index]);
+}
+
+void buffer_pool_free(void* buffer) {
+    int index = buffer_to_class(buffer);
+    class_free(&m_classes[index], &m_caches[index], buffer);
+}
+
+size_t buffer_pool_size(void* buffer) {
+    return m_classes[buffer_to_class(buffer)].size;
+}
+
+void* buffer_pool_get_protocol_send() {
+    if (m_reserved == NULL) {
+        return NULL;
+    }
+
+    // registered buffers are sent without pinning their pages every
+    // time, so they are used first
+    void* buffer = class_alloc(&m_classes[REGISTERED_CLASS], &m_caches[REGISTERED_CLASS]);
+    if (buffer != NULL) {
+        return buffer;
+    }
+
+    return class_alloc(&m_classes[m_send_class], &m_caches[m_send_class]);
+}
+
+void buffer_pool_return_protocol_send(void* buffer) {
+    buffer_pool_free(buffer);
+}
+
+bool buffer_pool_get_registered_send_region(struct iovec* region) {
+    size_class_t* registered = &m_classes[REGISTERED_CLASS];
+    if (registered->committed == registered->base) {
+        return false;
+    }
+    region->iov_base = registered->base;
+    region->iov_len = registered->committed - registered->base;
+    return true;
+}
+
+bool buffer_pool_is_registered_send(void* buffer) {
+    size_class_t* registered = &m_classes[REGISTERED_CLASS];
+    return (uint8_t*)buffer >= registered->base && (uint8_t*)buffer < registered->committed;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Recv is only done at a single path, so this can be lockless
+// Trimming
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void** m_tcp_recv = NULL;
+static bool low_on_memory() {
+    struct sysinfo info;
+    if (sysinfo(&info) != 0) {
+        return false;
+    }
+    return info.freeram + info.bufferram < info.totalram / LOW_MEMORY_FRACTION;
+}
 
-void* buffer_pool_get_tcp_recv() {
-    if (arrlen(m_tcp_recv) == 0) {
-        // we have no free mappings, just allocate a new one
-        void* ptr = mmap(NULL, g_server_config.recv_buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (ptr == MAP_FAILED) {
-            return NULL;
-        } else {
-            return ptr;
-        }
+/**
+ * Give back the memory of the free buffers that were not needed for the whole last
+ * interval, but only when there is pressure: either the idle buffers are over the
+ * limit or the system is low on memory. Whatever is in active use is never trimmed
+ */
+static void trim() {
+    size_t unused[BUFFER_POOL_CLASS_COUNT] = { 0 };
+    size_t idle_bytes = 0;
+
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; i++) {
+        size_class_t* class = &m_classes[i];
+        spin_lock_enter(&class->lock);
+        unused[i] = class->full_low;
+        class->full_low = class->full_count;
+        idle_bytes += class->full_buffers * class->size;
+        spin_lock_leave(&class->lock);
     }
 
-    // we have a mapping free already, reuse it
-    void* buffer = arrpop(m_tcp_recv);
+    bool low_memory = low_on_memory();
+    if (!low_memory && idle_bytes <= g_server_config.buffer_idle_limit) {
+        return;
+    }
 
-    // tell the kernel we are going to use this very soon, so prepare
-    // the page range
-    madvise(buffer, g_server_config.recv_buffer_size, MADV_WILLNEED);
+    // largest classes first, they give back the most memory per syscall
+    for (int i = BUFFER_POOL_CLASS_COUNT - 1; i >= 0; i--) {
+        size_class_t* class = &m_classes[i];
+        for (; unused[i] > 0; unused[i]--) {
+            if (!low_memory && idle_bytes <= g_server_config.buffer_idle_limit) {
+                return;
+            }
 
-    return buffer;
+            spin_lock_enter(&class->lock);
+            magazine_t* magazine = class->full;
+            if (magazine != NULL) {
+                class->full = magazine->next;
+                class->full_count--;
+                class->full_buffers -= magazine->count;
+                if (class->full_count < class->full_low) {
+                    class->full_low = class->full_count;
+                }
+            }
+            spin_lock_leave(&class->lock);
+            if (magazine == NULL) {
+                break;
+            }
+
+            // the pages are only reclaimed if the kernel needs them, until
+            // then using the buffer again costs nothing. A huge page that
+            // is only partly freed gets split, which is what we want when
+            // memory is tight
+            for (int j = 0; j < magazine->count; j++) {
+                madvise(magazine->rounds[j], class->size, MADV_FREE);
+            }
+            idle_bytes -= magazine->count * class->size;
+
+            spin_lock_enter(&class->lock);
+            magazine->next = class->trimmed;
+            class->trimmed = magazine;
+            class->trimmed_count += magazine->count;
+            spin_lock_leave(&class->lock);
+        }
+    }
 }
 
-void buffer_pool_return_tcp_recv(void* buffer) {
-    // just queue it
-    arrpush(m_tcp_recv, buffer);
+static int trimmer_thread(void* arg) {
+    struct timespec interval = {
+        .tv_sec = TRIM_INTERVAL_MS / 1000,
+        .tv_nsec = (TRIM_INTERVAL_MS % 1000) * 1000000
+    };
 
-    // tell the kernel we are no longer using this page range and it can
-    // free it should there be memory preasure
-    madvise(buffer, g_server_config.recv_buffer_size, MADV_FREE);
+    while (true) {
+        thrd_sleep(&interval, NULL);
+        trim();
+    }
+
+    return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Sending could be done at alot of points, so this need to be with locking
+// Init and stats
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static spin_lock_t m_protocol_send_lock;
+static void init_class(int index, size_t size, bool fixed) {
+    size_class_t* class = &m_classes[index];
+    class->size = size;
+    class->rounds = MAGAZINE_BYTES / size;
+    if (class->rounds > MAGAZINE_MAX_ROUNDS) {
+        class->rounds = MAGAZINE_MAX_ROUNDS;
+    } else if (class->rounds < 1) {
+        class->rounds = 1;
+    }
+    class->base = m_reserved + ((size_t)index << CLASS_RESERVE_SHIFT);
+    class->carve = class->base;
+    class->committed = class->base;
+    class->end = class->base + (1ull << CLASS_RESERVE_SHIFT);
+    class->fixed = fixed;
+    class->huge_pages = g_server_config.huge_pages && size >= CLASS_HUGE_MIN_SIZE;
+}
 
-static void** m_protocol_send_buffers = NULL;
+err_t init_buffer_pool() {
+    err_t err = NO_ERROR;
 
-void* buffer_pool_get_protocol_send() {
-    spin_lock_enter(&m_protocol_send_lock);
-    if (arrlen(m_protocol_send_buffers) == 0) {
-        spin_lock_leave(&m_protocol_send_lock);
+    CHECK(g_server_config.max_send_packet_size <= BUFFER_POOL_MAX_SIZE,
+          "max send packet size is over the largest buffer (got %zu)", g_server_config.max_send_packet_size);
+    CHECK(g_server_config.max_recv_packet_size <= BUFFER_POOL_MAX_SIZE,
+          "max recv packet size is over the largest buffer (got %zu)", g_server_config.max_recv_packet_size);
 
-        // we have no free mappings, just allocate a new one
-        void* ptr = mmap(NULL, g_server_config.max_send_packet_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (ptr == MAP_FAILED) {
-            return NULL;
+    // reserve the ranges of all the classes, nothing is committed until
+    // it is carved. Aligned so every buffer is aligned to its size
+    size_t reserve_size = (size_t)(BUFFER_POOL_CLASS_COUNT + 1) << CLASS_RESERVE_SHIFT;
+    void* reserved = mmap(NULL, reserve_size + BUFFER_POOL_MAX_SIZE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    CHECK_ERRNO(reserved != MAP_FAILED);
+    m_reserved = (uint8_t*)ALIGN_UP(reserved, BUFFER_POOL_MAX_SIZE);
+
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; i++) {
+        init_class(i, BUFFER_POOL_MIN_SIZE << i, false);
+    }
+    m_send_class = size_to_class(g_server_config.max_send_packet_size);
+
+    // the registered buffers are the size of the send class, and all of
+    // them are allocated up front
+    size_class_t* registered = &m_classes[REGISTERED_CLASS];
+    init_class(REGISTERED_CLASS, m_classes[m_send_class].size, true);
+    if (g_server_config.registered_send_buffers > 0) {
+        size_t region_size = g_server_config.registered_send_buffers * registered->size;
+        CHECK(region_size <= registered->end - registered->base, "Too many registered send buffers");
+
+        // populate it right away, it is going to be pinned by the kernel anyways
+        // once it is registered. With huge pages it has to be advised before the
+        // first touch, so it is populated by hand
+        if (registered->huge_pages) {
+            CHECK_ERRNO(mprotect(registered->base, region_size, PROT_READ | PROT_WRITE) == 0);
+            huge_pages_advise(registered->base, region_size);
+            for (size_t offset = 0; offset < region_size; offset += PAGE_SIZE) {
+                registered->base[offset] = 0;
+            }
         } else {
-            return ptr;
+            void* region = mmap(registered->base, region_size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_POPULATE, -1, 0);
+            CHECK_ERRNO(region != MAP_FAILED);
         }
-    }
+        registered->committed = registered->base + region_size;
 
-    // we have a mapping free already, reuse it
-    void* buffer = arrpop(m_protocol_send_buffers);
+        // and put all the buffers in the depot
+        while (registered->carve < registered->committed) {
+            magazine_t* magazine = new_magazine(registered);
+            CHECK_ERRNO(magazine != NULL);
+            class_carve(registered, magazine);
+            depot_put_full(registered, magazine);
+        }
+    }
 
-    spin_lock_leave(&m_protocol_send_lock);
+    CHECK_ERRNO(thrd_create(&m_trimmer_thread, trimmer_thread, NULL) == thrd_success);
 
-    // tell the kernel we are going to use this very soon, so prepare
-    // the page range
-    madvise(buffer, g_server_config.max_send_packet_size, MADV_WILLNEED);
+cleanup:
+    return err;
+}
 
-    return buffer;
+static void get_class_stats(size_class_t* class, buffer_pool_class_stats_t* stats) {
+    spin_lock_enter(&class->lock);
+    stats->size = class->size;
+    stats->hits = class->hits;
+    stats->misses = class->misses;
+    stats->resident_bytes = (class->carved - class->trimmed_count) * class->size;
+    stats->idle_bytes = (class->free_count - class->trimmed_count) * class->size;
+    stats->trimmed_bytes = class->trimmed_count * class->size;
+    spin_lock_leave(&class->lock);
 }
 
-void buffer_pool_return_protocol_send(void* buffer) {
-    spin_lock_enter(&m_protocol_send_lock);
-    arrpush(m_protocol_send_buffers, buffer);
-    madvise(buffer, g_server_config.max_send_packet_size, MADV_FREE);
-    spin_lock_leave(&m_protocol_send_lock);
+void buffer_pool_get_stats(buffer_pool_stats_t* stats) {
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; i++) {
+        get_class_stats(&m_classes[i], &stats->classes[i]);
+    }
+    get_class_stats(&m_classes[REGISTERED_CLASS], &stats->registered);
 }
@@ -1,16 +1,112 @@
 #pragma once
 
+#include <lib/except.h>
+
+#include <sys/uio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
- * Get a recv data for a packet, this is always
- * @return
+ * Buffers are handed out from size classes, one for every power
+ * of two between the min and max size
  */
-void* buffer_pool_get_protocol_recv();
-void buffer_pool_return_protocol_recv(void* buffer);
+#define BUFFER_POOL_MIN_SIZE        256
+#define BUFFER_POOL_MAX_SIZE        (2 * 1024 * 1024)
+#define BUFFER_POOL_CLASS_COUNT     14
+
+typedef struct buffer_pool_class_stats {
+    /**
+     * The size of the buffers of the class
+     */
+    size_t size;
+
+    /**
+     * Allocations that were served from the magazines of the thread, and the ones
+     * that had to go to the depot of the class (or carve new buffers). Threads only
+     * add their hits here once they go to the depot, so the hits lag a bit
+     */
+    uint64_t hits;
+    uint64_t misses;
+
+    /**
+     * The memory of the class that is backed by pages, this is everything that was
+     * carved minus what the trimmer gave back. Idle is the part of it sitting in
+     * the depot, free buffers in the magazines of the threads are not counted
+     */
+    size_t resident_bytes;
+    size_t idle_bytes;
 
-void* buffer_pool_get_tcp_recv();
-void buffer_pool_return_tcp_recv(void* buffer);
+    /**
+     * The free buffers that the trimmer gave back to the kernel
+     */
+    size_t trimmed_bytes;
+} buffer_pool_class_stats_t;
+
+typedef struct buffer_pool_stats {
+    buffer_pool_class_stats_t classes[BUFFER_POOL_CLASS_COUNT];
+
+    // the send buffers that are registered with the rings, these
+    // are allocated up front and never trimmed
+    buffer_pool_class_stats_t registered;
+} buffer_pool_stats_t;
+
+/**
+ * Initialize the buffer pool, this reserves the address space of the classes,
+ * allocates the send buffers that are going to be registered with the rings
+ * and starts the trimmer
+ */
+err_t init_buffer_pool();
+
+/**
+ * Get the region of the send buffers that should be registered as a
+ * fixed buffer, returns false if there is no such region
+ *
+ * @param region    [OUT] The region to register
+ */
+bool buffer_pool_get_registered_send_region(struct iovec* region);
+
+/**
+ * Check if the send buffer is inside the registered region
+ *
+ * @param buffer    [IN] The buffer from buffer_pool_get_protocol_send
+ */
+bool buffer_pool_is_registered_send(void* buffer);
 
+/**
+ * Allocate a buffer from the smallest class that fits the size, this only takes
+ * a lock once the magazines of the thread run out
+ *
+ * @param size      [IN] The size, at most BUFFER_POOL_MAX_SIZE
+ *
+ * @return The buffer, NULL if out of memory
+ */
+void* buffer_pool_alloc(size_t size);
+
+/**
+ * Free a buffer, this can be done from any thread
+ *
+ * @param buffer    [IN] The buffer from buffer_pool_alloc or buffer_pool_get_protocol_send
+ */
+void buffer_pool_free(void* buffer);
+
+/**
+ * The usable size of the buffer, which is the size of its class
+ *
+ * @param buffer    [IN] The buffer
+ */
+size_t buffer_pool_size(void* buffer);
+
+/**
+ * Get a send buffer, it has room for the max send packet size (including the
+ * headroom). The registered buffers are handed out first
+ */
 void* buffer_pool_get_protocol_send();
 void buffer_pool_return_protocol_send(void* buffer);
+
+/**
+ * Get the stats of all the classes
+ *
+ * @param stats     [OUT] The stats
+ */
+void buffer_pool_get_stats(buffer_pool_stats_t* stats);
@@ -1,22 +1,112 @@
 #pragma once
 
+#include <net/send_queue.h>
 #include <net/receiver.h>
+#include <net/timer_wheel.h>
+#include <net/request.h>
 #include <lib/list.h>
 
 #include <netinet/in.h>
 
+struct reactor;
+
+/**
+ * A reference to a client that can be held outside of its reactor (by the game
+ * tick), it is only resolved on the reactor and resolves to nothing once the
+ * client is freed
+ */
+typedef struct client_handle {
+    uint32_t reactor;
+    uint32_t slot;
+    uint32_t generation;
+} client_handle_t;
+
 typedef struct client {
     /**
-     * The node of the client
+     * The reactor that owns this client, all the io of
+     * the client goes through its ring
+     */
+    struct reactor* reactor;
+
+    /**
+     * The clients of a reactor live in a slab, the slot of the client in it is
+     * the same as the slot of its socket in the registered file table of the
+     * ring. The generation is bumped every time the slot is freed, so a
+     * completion that was meant for the previous client of the slot is
+     * recognized and dropped
      */
-    list_node_t node;
+    bool in_use;
+    uint32_t generation;
 
     /**
-     * The socket of the client
+     * The socket of the client, this is the slot of the socket in
+     * the registered file table of the reactor ring
      */
     int socket;
     struct sockaddr_in address;
 
+    /**
+     * The client is shutting down, we are only waiting for its multishot
+     * recv to terminate and its send to complete before freeing it
+     */
+    bool closing;
+    bool recv_active;
+    bool send_in_flight;
+
+    /**
+     * The amount of ops that still reference the client (the recv, sends until
+     * their last completion, jobs running on workers), the slot of the client is
+     * not freed until this drops to zero
+     */
+    int ops_in_flight;
+
+    /**
+     * The contexts of the recv and the send of the client, only a single one
+     * of each is in flight so they live here instead of in the request pool.
+     * The send context is busy until the zero copy notification of its send
+     * arrives, a send that is flushed before that takes one from the pool
+     */
+    request_t recv_request;
+    request_t send_request;
+    bool send_request_busy;
+
+    /**
+     * Is the recv being canceled so the client can move to a receive ring
+     */
+    bool switch_to_ring;
+
+    /**
+     * The deadline timer of the client, it only expires when the client may
+     * have timed out and decides what to do based on the state of the client
+     */
+    wheel_timer_t timer;
+
+    /**
+     * The tick the client was accepted at, and the tick it last sent
+     * anything at, both in ticks of the timer wheel of the reactor
+     */
+    uint64_t accepted_at;
+    uint64_t last_recv;
+
+    /**
+     * The tick the next keep alive is sent at, once playing
+     */
+    uint64_t next_keep_alive;
+
+    /**
+     * The packets that are waiting to be sent, flushed once per
+     * reactor loop iteration while the client is on the dirty list
+     */
+    send_queue_t send_queue;
+    list_node_t dirty_node;
+    bool dirty;
+
+    /**
+     * Packets that are waiting for a compression worker, and the packets
+     * that were sent after them, they are queued in order once done
+     */
+    list_t pending_sends;
+
     /**
      * The state of the protocol, used for properly
      * consuming bytes as they arrive
@@ -29,7 +119,20 @@ typedef struct client {
     protocol_state_t state;
 
     /**
-     * The data used for recv
+     * The login of the client, only used until it gets to the play state
      */
-    uint8_t* recv_buffer;
+    struct {
+        // the name the client logged in with
+        char username[17];
+
+        // the token sent in the encryption request, the client must send it back
+        uint8_t verify_token[4];
+
+        // the encryption request was sent
+        bool encryption_requested;
+
+        // the encryption response is being decrypted, the client
+        // must not send anything until we reply to it
+        bool key_exchange;
+    } login;
 } client_t;
@@ -0,0 +1,77 @@
+#include "compression.h"
+
+#include <threads.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+/**
+ * The streams of this thread, they are set up once and only reset between
+ * packets, zlib keeps its window and hash tables around between resets
+ */
+static thread_local z_stream m_deflate_stream;
+static thread_local bool m_deflate_initialized = false;
+static thread_local int m_deflate_level = Z_DEFAULT_COMPRESSION;
+
+static thread_local z_stream m_inflate_stream;
+static thread_local bool m_inflate_initialized = false;
+
+err_t compression_deflate(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_capacity, int level, size_t* out_size) {
+    err_t err = NO_ERROR;
+    z_stream* stream = &m_deflate_stream;
+
+    if (!m_deflate_initialized) {
+        int ret = deflateInit(stream, level);
+        CHECK(ret == Z_OK, "Failed to initialize deflate: %d", ret);
+        m_deflate_initialized = true;
+        m_deflate_level = level;
+    } else {
+        CHECK(deflateReset(stream) == Z_OK);
+        if (m_deflate_level != level) {
+            // no data went through the stream since the reset so
+            // this only changes the parameters
+            CHECK(deflateParams(stream, level, Z_DEFAULT_STRATEGY) == Z_OK);
+            m_deflate_level = level;
+        }
+    }
+
+    // compress it all in one go
+    stream->next_in = (Bytef*)in;
+    stream->avail_in = in_size;
+    stream->next_out = out;
+    stream->avail_out = out_capacity;
+    int ret = deflate(stream, Z_FINISH);
+    if (ret == Z_STREAM_END) {
+        *out_size = stream->total_out;
+    } else {
+        // not compressible enough to fit
+        CHECK(ret == Z_OK || ret == Z_BUF_ERROR, "Failed to deflate: %d", ret);
+        *out_size = 0;
+    }
+
+cleanup:
+    return err;
+}
+
+err_t compression_inflate(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size) {
+    err_t err = NO_ERROR;
+    z_stream* stream = &m_inflate_stream;
+
+    if (!m_inflate_initialized) {
+        int ret = inflateInit(stream);
+        CHECK(ret == Z_OK, "Failed to initialize inflate: %d", ret);
+        m_inflate_initialized = true;
+    } else {
+        CHECK(inflateReset(stream) == Z_OK);
+    }
+
+    stream->next_in = (Bytef*)in;
+    stream->avail_in = in_size;
+    stream->next_out = out;
+    stream->avail_out = out_size;
+    int ret = inflate(stream, Z_FINISH);
+    CHECK_ERROR(ret == Z_STREAM_END && stream->total_out == out_size, ERROR_PROTOCOL,
+                "Got badly compressed packet (%d, %lu/%zu bytes)", ret, stream->total_out, out_size);
+
+cleanup:
+    return err;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <lib/except.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Deflate a packet, every thread has its own compressor that is reset between
+ * packets so no allocation is done per packet
+ *
+ * @param in            [IN]    The uncompressed packet
+ * @param in_size       [IN]    The size of the packet
+ * @param out           [IN]    Where to write the compressed data
+ * @param out_capacity  [IN]    The size of the output
+ * @param level         [IN]    The deflate level, 1 (fastest) to 9 (smallest)
+ * @param out_size      [OUT]   The size of the compressed data, 0 if it did not fit
+ */
+err_t compression_deflate(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_capacity, int level, size_t* out_size);
+
+/**
+ * Inflate a packet, like deflate the decompressor is per thread
+ *
+ * @param in            [IN] The compressed data
+ * @param in_size       [IN] The size of the compressed data
+ * @param out           [IN] Where to write the packet
+ * @param out_size      [IN] The size of the packet, the data must inflate to exactly this
+ */
+err_t compression_inflate(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size);
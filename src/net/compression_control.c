@@ -0,0 +1,151 @@
+#include "compression_control.h"
+#include "compression_worker.h"
+#include "server.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * The amount of ticks between decisions, a second worth of ticks
+ */
+#define CONTROL_WINDOW_TICKS 20
+
+/**
+ * Above this fraction of the budget we make compression cheaper, below the
+ * low one we make it smaller, the gap keeps it from flapping
+ */
+#define CONTROL_HIGH_PRESSURE 0.8
+#define CONTROL_LOW_PRESSURE 0.5
+
+/**
+ * The decisions, written by the game loop and read by whoever compresses
+ */
+static atomic_int m_level = 0;
+static atomic_int m_threshold = 0;
+
+/**
+ * The stats of the last window, only the game loop writes them
+ */
+static _Atomic(double) m_mspt = 0;
+static _Atomic(double) m_worker_utilization = 0;
+static atomic_uint_fast64_t m_decreases = 0;
+static atomic_uint_fast64_t m_increases = 0;
+
+/**
+ * The window being measured, only touched by the game loop
+ */
+static int m_window_ticks = 0;
+static uint64_t m_window_tick_ns = 0;
+static uint64_t m_window_start_ns = 0;
+static uint64_t m_window_start_busy_ns = 0;
+
+static uint64_t get_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+err_t init_compression_control() {
+    err_t err = NO_ERROR;
+
+    CHECK(g_server_config.compression_level_min >= 1 && g_server_config.compression_level_max <= 9 &&
+          g_server_config.compression_level_min <= g_server_config.compression_level_max,
+          "Invalid compression level bounds %d-%d", g_server_config.compression_level_min, g_server_config.compression_level_max);
+    CHECK(g_server_config.compression_level >= g_server_config.compression_level_min &&
+          g_server_config.compression_level <= g_server_config.compression_level_max,
+          "Compression level %d is out of bounds", g_server_config.compression_level);
+
+    atomic_store_explicit(&m_level, g_server_config.compression_level, memory_order_relaxed);
+    atomic_store_explicit(&m_threshold, g_server_config.compression_threshold, memory_order_relaxed);
+
+    m_window_start_ns = get_time_ns();
+    m_window_start_busy_ns = compression_workers_busy_ns();
+
+cleanup:
+    return err;
+}
+
+void compression_control_tick(uint64_t tick_ns) {
+    if (g_server_config.compression_threshold < 0) {
+        return;
+    }
+
+    m_window_tick_ns += tick_ns;
+    if (++m_window_ticks < CONTROL_WINDOW_TICKS) {
+        return;
+    }
+
+    // how busy were we in this window
+    uint64_t now = get_time_ns();
+    uint64_t busy_ns = compression_workers_busy_ns();
+    double mspt = (double)m_window_tick_ns / m_window_ticks / 1000000.0;
+    double utilization = 0;
+    if (g_server_config.compression_workers > 0 && now > m_window_start_ns) {
+        utilization = (double)(busy_ns - m_window_start_busy_ns) / (double)(now - m_window_start_ns) / g_server_config.compression_workers;
+    }
+
+    m_window_ticks = 0;
+    m_window_tick_ns = 0;
+    m_window_start_ns = now;
+    m_window_start_busy_ns = busy_ns;
+
+    // the pressure is whatever is closer to its limit
+    double pressure = mspt / g_server_config.compression_target_mspt;
+    if (utilization > pressure) {
+        pressure = utilization;
+    }
+
+    int level = atomic_load_explicit(&m_level, memory_order_relaxed);
+    int threshold = atomic_load_explicit(&m_threshold, memory_order_relaxed);
+    if (pressure > CONTROL_HIGH_PRESSURE) {
+        // cheaper first, then compress less packets
+        if (level > g_server_config.compression_level_min) {
+            level--;
+        } else if (threshold < g_server_config.compression_threshold_max) {
+            threshold = threshold < 64 ? 64 : threshold * 2;
+            if (threshold > g_server_config.compression_threshold_max) {
+                threshold = g_server_config.compression_threshold_max;
+            }
+        } else {
+            goto publish;
+        }
+        atomic_fetch_add_explicit(&m_decreases, 1, memory_order_relaxed);
+    } else if (pressure < CONTROL_LOW_PRESSURE) {
+        // undo in the reverse order
+        if (threshold > g_server_config.compression_threshold) {
+            threshold /= 2;
+            if (threshold < g_server_config.compression_threshold) {
+                threshold = g_server_config.compression_threshold;
+            }
+        } else if (level < g_server_config.compression_level_max) {
+            level++;
+        } else {
+            goto publish;
+        }
+        atomic_fetch_add_explicit(&m_increases, 1, memory_order_relaxed);
+    }
+
+publish:
+    atomic_store_explicit(&m_level, level, memory_order_relaxed);
+    atomic_store_explicit(&m_threshold, threshold, memory_order_relaxed);
+    atomic_store_explicit(&m_mspt, mspt, memory_order_relaxed);
+    atomic_store_explicit(&m_worker_utilization, utilization, memory_order_relaxed);
+}
+
+int compression_control_level() {
+    return atomic_load_explicit(&m_level, memory_order_relaxed);
+}
+
+int compression_control_threshold() {
+    return atomic_load_explicit(&m_threshold, memory_order_relaxed);
+}
+
+void compression_control_get_stats(compression_control_stats_t* stats) {
+    stats->level = atomic_load_explicit(&m_level, memory_order_relaxed);
+    stats->threshold = atomic_load_explicit(&m_threshold, memory_order_relaxed);
+    stats->mspt = atomic_load_explicit(&m_mspt, memory_order_relaxed);
+    stats->worker_utilization = atomic_load_explicit(&m_worker_utilization, memory_order_relaxed);
+    stats->decreases = atomic_load_explicit(&m_decreases, memory_order_relaxed);
+    stats->increases = atomic_load_explicit(&m_increases, memory_order_relaxed);
+}
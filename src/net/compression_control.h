@@ -0,0 +1,69 @@
+#pragma once
+
+#include <lib/except.h>
+
+#include <stdint.h>
+
+/**
+ * Picks the deflate level and the size from which packets are compressed based on
+ * how much cpu we can spare: when the tick takes long or the compression workers
+ * are busy compression gets cheaper, when both are idle it gets smaller
+ */
+
+typedef struct compression_control_stats {
+    /**
+     * The current deflate level
+     */
+    int level;
+
+    /**
+     * Packets from this size are compressed, never lower than
+     * the threshold the clients were told about
+     */
+    int threshold;
+
+    /**
+     * The average tick time over the last window, in milliseconds
+     */
+    double mspt;
+
+    /**
+     * The fraction of time the compression workers were busy over the last window
+     */
+    double worker_utilization;
+
+    /**
+     * The amount of times the controller made compression cheaper or smaller
+     */
+    uint64_t decreases;
+    uint64_t increases;
+} compression_control_stats_t;
+
+/**
+ * Setup the controller from the server config
+ */
+err_t init_compression_control();
+
+/**
+ * Called by the game loop at the end of every tick
+ *
+ * @param tick_ns   [IN] How long the tick took, in nanoseconds
+ */
+void compression_control_tick(uint64_t tick_ns);
+
+/**
+ * The deflate level to compress with
+ */
+int compression_control_level();
+
+/**
+ * The size from which packets should be compressed
+ */
+int compression_control_threshold();
+
+/**
+ * Get the current decisions of the controller and what they were based on
+ *
+ * @param stats     [OUT] The stats
+ */
+void compression_control_get_stats(compression_control_stats_t* stats);
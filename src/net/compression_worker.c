@@ -0,0 +1,36 @@
+#include "compression_worker.h"
+#include "framing.h"
+
+static worker_pool_t m_compression_workers = { 0 };
+
+/**
+ * Compress it, the framing goes into the headroom of the new buffer
+ */
+static void compress_packet(worker_job_t* worker_job) {
+    compression_job_t* job = (compression_job_t*)worker_job;
+    job->err = frame_packet(&job->buffer, job->size, true, &job->frame, &job->frame_size);
+}
+
+err_t init_compression_workers(int count) {
+    return init_worker_pool(&m_compression_workers, "compression", count);
+}
+
+bool compression_workers_available() {
+    return m_compression_workers.count > 0;
+}
+
+uint64_t compression_workers_busy_ns() {
+    return worker_pool_busy_ns(&m_compression_workers);
+}
+
+void compression_job_init(compression_job_t* job, int reply_ring_fd, uint64_t reply_data) {
+    job->job = (worker_job_t){
+        .run = compress_packet,
+        .reply_ring_fd = reply_ring_fd,
+        .reply_data = reply_data,
+    };
+}
+
+void compression_worker_submit(struct io_uring_sqe* sqe, compression_job_t* job) {
+    worker_pool_submit(&m_compression_workers, sqe, &job->job);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <net/worker_pool.h>
+#include <lib/except.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Deflating large packets (chunks can be 100+ KiB) on a reactor would stall all
+ * of its other clients, so they are handed to a pool of compression workers
+ */
+typedef struct compression_job {
+    // the job of the pool, must be first
+    worker_job_t job;
+
+    // the packet to compress, the worker replaces it
+    // with the buffer holding the compressed packet
+    uint8_t* buffer;
+    size_t size;
+
+    // the framed packet, set by the worker
+    uint8_t* frame;
+    size_t frame_size;
+
+    // the result of framing the packet, if it failed
+    // the buffer is still the original one
+    err_t err;
+} compression_job_t;
+
+/**
+ * Start the compression workers, with no workers compression
+ * is done inline by the caller
+ *
+ * @param count     [IN] The amount of workers
+ */
+err_t init_compression_workers(int count);
+
+/**
+ * Are there any compression workers
+ */
+bool compression_workers_available();
+
+/**
+ * The total time all the workers spent compressing, in nanoseconds
+ */
+uint64_t compression_workers_busy_ns();
+
+/**
+ * Setup the job, must be called before submitting it or running it inline
+ *
+ * @param job           [IN] The job
+ * @param reply_ring_fd [IN] The ring to post the completion to
+ * @param reply_data    [IN] The user data of the completion
+ */
+void compression_job_init(compression_job_t* job, int reply_ring_fd, uint64_t reply_data);
+
+/**
+ * Hand a job to one of the workers, see worker_pool_submit
+ *
+ * @param sqe   [IN] An sqe of the ring of the caller
+ * @param job   [IN] The job, must stay alive until it is done
+ */
+void compression_worker_submit(struct io_uring_sqe* sqe, compression_job_t* job);
@@ -0,0 +1,102 @@
+#include "framer.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+static bool m_use_simd = true;
+
+void framer_use_simd(bool enabled) {
+    m_use_simd = enabled;
+}
+
+/**
+ * Decode the length byte by byte, used near the end of the buffer
+ *
+ * @return The size of the varint, 0 if it is not all in the buffer, -1 if it is invalid
+ */
+static int read_length_scalar(const uint8_t* data, size_t len, uint32_t* length) {
+    uint32_t value = 0;
+    for (int i = 0; i < FRAMER_MAX_LENGTH_BYTES; i++) {
+        if (i == len) {
+            return 0;
+        }
+        value |= (uint32_t)(data[i] & 0x7F) << (i * 7);
+        if ((data[i] & 0x80) == 0) {
+            *length = value;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Decode a single length with the continuation bits of the 16 bytes it starts, the
+ * buffer must have at least 16 bytes left. This is per packet and not a scan of the
+ * whole buffer, the next length can't be found before this one is decoded
+ *
+ * @return The size of the varint, -1 if it is invalid
+ */
+static int read_length_sse2(const uint8_t* data, uint32_t* length) {
+    // most packets are small, and a predicted branch is
+    // cheaper than going through the vector unit
+    if (data[0] < 0x80) {
+        *length = data[0];
+        return 1;
+    }
+
+    // the first byte without the continuation bit ends the varint
+    __m128i bytes = _mm_loadu_si128((const __m128i*)data);
+    uint32_t continuation = _mm_movemask_epi8(bytes);
+    int size = __builtin_ctz(~continuation) + 1;
+    if (size > FRAMER_MAX_LENGTH_BYTES) {
+        return -1;
+    }
+
+    // drop the continuation bits and squash the 7 bit groups together,
+    // bytes past the end of the varint are masked out first
+    uint32_t word = (uint32_t)_mm_cvtsi128_si32(bytes) & (0xFFFFFFFFu >> (32 - size * 8));
+    *length = (word & 0x7F) | ((word >> 1) & 0x3F80) | ((word >> 2) & 0x1FC000);
+    return size;
+}
+
+#endif
+
+int framer_read_length(const uint8_t* data, size_t len, uint32_t* length) {
+    return read_length_scalar(data, len, length);
+}
+
+int framer_scan(const uint8_t* data, size_t len, uint32_t max_length, frame_t* frames, int max_frames, size_t* consumed) {
+    size_t offset = 0;
+    int count = 0;
+
+    while (count < max_frames && offset < len) {
+        uint32_t length = 0;
+        int size = 0;
+#if defined(__x86_64__)
+        if (m_use_simd && len - offset >= 16) {
+            size = read_length_sse2(data + offset, &length);
+        } else
+#endif
+        {
+            size = read_length_scalar(data + offset, len - offset, &length);
+        }
+
+        // incomplete, invalid or too large, leave it to the caller
+        if (size <= 0 || length > max_length || length > len - offset - size) {
+            break;
+        }
+
+        frames[count].offset = offset + size;
+        frames[count].length = length;
+        count++;
+        offset += size + length;
+    }
+
+    *consumed = offset;
+    return count;
+}
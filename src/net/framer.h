@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The packet lengths are limited to 21 bits, a longer varint is never valid
+ */
+#define FRAMER_MAX_LENGTH_BYTES 3
+
+/**
+ * A packet found in a recv buffer
+ */
+typedef struct frame {
+    // where the packet starts, right after its length
+    uint32_t offset;
+
+    // the length of the packet
+    uint32_t length;
+} frame_t;
+
+/**
+ * Find all the complete packets in a buffer that starts at a packet boundary. This
+ * walks the packets one after the other, where a packet starts depends on the length
+ * of the one before it. Only decoding each length uses SSE2 when it is available, the
+ * continuation bits of that length are taken with a single 16 byte load.
+ *
+ * The scan stops at the first packet that is not all in the buffer, or whose length
+ * is invalid or over the max, everything from there on is left to the caller
+ *
+ * @param data          [IN]    The buffer
+ * @param len           [IN]    The size of the buffer
+ * @param max_length    [IN]    The largest packet that is allowed
+ * @param frames        [OUT]   The packets that were found
+ * @param max_frames    [IN]    The amount of entries in frames
+ * @param consumed      [OUT]   The amount of bytes the packets that were found take
+ *
+ * @return The amount of packets that were found
+ */
+int framer_scan(const uint8_t* data, size_t len, uint32_t max_length, frame_t* frames, int max_frames, size_t* consumed);
+
+/**
+ * Decode a single packet length with the same rules as framer_scan, for
+ * telling apart a packet that is not all here yet from an invalid one
+ *
+ * @param data      [IN]    The buffer, starting at the length
+ * @param len       [IN]    The size of the buffer
+ * @param length    [OUT]   The length of the packet
+ *
+ * @return The size of the length, 0 if it is not all in the buffer, -1 if it is invalid
+ */
+int framer_read_length(const uint8_t* data, size_t len, uint32_t* length);
+
+/**
+ * Allow or disallow the SIMD implementation, only
+ * useful for comparing them
+ */
+void framer_use_simd(bool enabled);
@@ -0,0 +1,60 @@
+#include "framing.h"
+#include "buffer_pool.h"
+#include "compression.h"
+#include "compression_control.h"
+#include "server.h"
+
+err_t frame_packet(uint8_t** buffer, size_t size, bool compression, uint8_t** frame, size_t* frame_size) {
+    err_t err = NO_ERROR;
+    uint8_t* out = *buffer + SERVER_SEND_HEADROOM;
+    size_t out_size = size;
+
+    // the uncompressed length, this is 0 for packets that are sent as is
+    int data_length = -1;
+    if (compression) {
+        data_length = 0;
+        if (size >= compression_control_threshold()) {
+            // deflate into a new buffer, leaving room for the framing
+            uint8_t* compressed = buffer_pool_get_protocol_send();
+            CHECK_ERRNO(compressed != NULL);
+
+            size_t compressed_size = 0;
+            err = compression_deflate(out, size, compressed + SERVER_SEND_HEADROOM,
+                                      g_server_config.max_send_packet_size - SERVER_SEND_HEADROOM,
+                                      compression_control_level(), &compressed_size);
+            if (IS_ERROR(err) || compressed_size == 0) {
+                // failed or did not fit, in which case it is sent as is
+                buffer_pool_return_protocol_send(compressed);
+                CHECK_AND_RETHROW(err);
+            } else {
+                buffer_pool_return_protocol_send(*buffer);
+                *buffer = compressed;
+                out = compressed + SERVER_SEND_HEADROOM;
+                out_size = compressed_size;
+                data_length = size;
+            }
+        }
+    }
+
+    // serialize the framing into the headroom right before the packet, with
+    // compression that is the packet length followed by the data length
+    if (data_length >= 0) {
+        int data_length_len = protocol_varint_size(data_length);
+        int length_len = protocol_varint_size(out_size + data_length_len);
+        out -= length_len + data_length_len;
+        CHECK(protocol_write_varint(out, length_len, out_size + data_length_len) == length_len);
+        CHECK(protocol_write_varint(out + length_len, data_length_len, data_length) == data_length_len);
+        out_size += length_len + data_length_len;
+    } else {
+        int length_len = protocol_varint_size(out_size);
+        out -= length_len;
+        CHECK(protocol_write_varint(out, length_len, out_size) == length_len);
+        out_size += length_len;
+    }
+
+    *frame = out;
+    *frame_size = out_size;
+
+cleanup:
+    return err;
+}
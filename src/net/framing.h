@@ -0,0 +1,22 @@
+#pragma once
+
+#include <lib/except.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Frame a packet for sending, this compresses it if needed and writes the
+ * length (and with compression the data length) into the headroom right
+ * before it
+ *
+ * @param buffer        [IN/OUT] The send buffer, the packet starts at SERVER_SEND_HEADROOM. If the
+ *                               packet got compressed this is replaced with the buffer holding the
+ *                               compressed packet and the original buffer is returned to the pool
+ * @param size          [IN]     The size of the packet
+ * @param compression   [IN]     Is compression enabled for the client
+ * @param frame         [OUT]    The frame inside the buffer
+ * @param frame_size    [OUT]    The size of the frame
+ */
+err_t frame_packet(uint8_t** buffer, size_t size, bool compression, uint8_t** frame, size_t* frame_size);
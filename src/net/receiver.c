@@ -5,10 +5,17 @@
 #include <string.h>
 #include <net/server.h>
 #include <net/buffer_pool.h>
+#include <net/compression.h>
+#include <net/framer.h>
 #include <netinet/in.h>
 #include <lib/stb_ds.h>
 #include <minecraft_protodef.h>
 
+/**
+ * The most packets that are framed in one scan
+ */
+#define BATCH_FRAMES 64
+
 #define FETCHER_BEGIN \
     switch (receiver_state->line) { \
         case 0:
@@ -25,12 +32,93 @@
         case __LINE__: \
     } while (0)
 
+/**
+ * Decompress the packet if needed and dispatch it
+ */
+static err_t handle_packet(client_t* client, uint8_t* packet, int packet_length) {
+    err_t err = NO_ERROR;
+    receiver_state_t* receiver_state = &client->receiver_state;
+
+    if (receiver_state->compression) {
+        int data_length = 0;
+        int read_size = protocol_read_varint(packet, packet_length, &data_length);
+        CHECK_ERROR(read_size > 0, ERROR_PROTOCOL, "Got invalid data length");
+        uint8_t* compressed = packet + read_size;
+        int compressed_length = packet_length - read_size;
+
+        if (data_length == 0) {
+            // the packet was below the threshold and sent as is
+            CHECK_AND_RETHROW(dispatch_packet(client, compressed, compressed_length));
+        } else {
+            CHECK_ERROR(data_length >= g_server_config.compression_threshold, ERROR_PROTOCOL,
+                        "Client compressed a packet below the threshold (%d bytes)", data_length);
+            CHECK_ERROR(data_length <= g_server_config.max_recv_packet_size, ERROR_PROTOCOL,
+                        "Client tried to send packet larger than supported (wanted %d)", data_length);
+
+            // inflate into a buffer of its own
+            receiver_state->decompressed = buffer_pool_alloc(data_length);
+            CHECK_ERRNO(receiver_state->decompressed != NULL);
+            CHECK_AND_RETHROW(compression_inflate(compressed, compressed_length, receiver_state->decompressed, data_length));
+            CHECK_AND_RETHROW(dispatch_packet(client, receiver_state->decompressed, data_length));
+
+            buffer_pool_free(receiver_state->decompressed);
+            receiver_state->decompressed = NULL;
+        }
+    } else {
+        // now pass the packet for dispatching
+        CHECK_AND_RETHROW(dispatch_packet(client, packet, packet_length));
+    }
+
+cleanup:
+    if (IS_ERROR(err) && receiver_state->decompressed != NULL) {
+        buffer_pool_free(receiver_state->decompressed);
+        receiver_state->decompressed = NULL;
+    }
+    return err;
+}
+
 err_t receiver_consume_data(client_t* client, uint8_t* data, size_t len) {
     err_t err = NO_ERROR;
     receiver_state_t* receiver_state = &client->receiver_state;
 
+    // decrypt everything right in the recv buffer
+    bool decrypted = receiver_state->encryption;
+    if (decrypted) {
+        aes_cfb8_decrypt(&receiver_state->cipher, data, len);
+    }
+
     // fetch all the packets we can from the stream
     while (len > 0) {
+        if (receiver_state->line == 0) {
+            // we are at a packet boundary, frame all the complete packets in one go
+            frame_t frames[BATCH_FRAMES];
+            size_t consumed = 0;
+            int count = framer_scan(data, len, g_server_config.max_recv_packet_size, frames, BATCH_FRAMES, &consumed);
+            for (int i = 0; i < count; i++) {
+                CHECK_AND_RETHROW(handle_packet(client, data + frames[i].offset, frames[i].length));
+
+                // the packet enabled encryption, the rest was framed before it was decrypted
+                if (receiver_state->encryption && !decrypted) {
+                    consumed = frames[i].offset + frames[i].length;
+                    break;
+                }
+            }
+            data += consumed;
+            len -= consumed;
+
+            // the packet enabled encryption, everything after it is encrypted
+            if (receiver_state->encryption && !decrypted) {
+                aes_cfb8_decrypt(&receiver_state->cipher, data, len);
+                decrypted = true;
+            }
+
+            // go through the state machine only for what is left at the end, a
+            // packet that is not all here yet or one that is not valid
+            if (count > 0) {
+                continue;
+            }
+        }
+
         FETCHER_BEGIN
             receiver_state->varint.length = 0;
             receiver_state->packet_length = 0;
@@ -41,19 +129,23 @@ err_t receiver_consume_data(client_t* client, uint8_t* data, size_t len) {
                 len--;
                 data++;
 
+                // make sure the varint is valid, the same limit as the framer
+                CHECK_ERROR(receiver_state->varint.length < FRAMER_MAX_LENGTH_BYTES, ERROR_PROTOCOL, "varint was too long");
+
                 // set the value
                 receiver_state->packet_length |= (current_byte & 0x7F) << (receiver_state->varint.length * 7);
                 receiver_state->varint.length++;
 
-                // make sure the varint is valid
-                CHECK(receiver_state->varint.length <= 5, "varint was too long");
-
                 // check if we finished
-                if ((receiver_state->varint.current_byte & 0x80) == 0) {
+                if ((current_byte & 0x80) == 0) {
                     break;
                 }
             }
 
+            // make sure the packet is valid
+            CHECK_ERROR(receiver_state->packet_length <= g_server_config.max_recv_packet_size, ERROR_PROTOCOL,
+                        "Client tried to send packet larger than supported (wanted %d)", receiver_state->packet_length);
+
             if (receiver_state->packet_length <= len) {
                 // fast path, we can use the data directly because the packet
                 // is small enough to fit in it
@@ -62,11 +154,9 @@ err_t receiver_consume_data(client_t* client, uint8_t* data, size_t len) {
                 len -= receiver_state->packet_length;
             } else {
                 // slow path, we need to recv more than the amount we have right
-                // now, so we need to properly handle it
-
-                // make sure the packet is valid, if it is get a page from the range
-                CHECK(receiver_state->packet_length <= g_server_config.max_recv_packet_size, "Client tried to send packet larger than supported (wanted %d)", receiver_state->packet_length);
-                receiver_state->packet = buffer_pool_get_protocol_recv();
+                // now, so we need to properly handle it, get a buffer that fits it
+                receiver_state->packet = buffer_pool_alloc(receiver_state->packet_length);
+                CHECK_ERRNO(receiver_state->packet != NULL);
                 receiver_state->should_return = true;
 
                 // recv the packet data, we will handle the compression or
@@ -76,10 +166,6 @@ err_t receiver_consume_data(client_t* client, uint8_t* data, size_t len) {
                     size_t offset = receiver_state->packet_length - receiver_state->left_to_read;
                     size_t can_copy = len > receiver_state->left_to_read ? receiver_state->left_to_read : len;
                     memcpy(receiver_state->packet + offset, data, can_copy);
-                    if (receiver_state->encryption) {
-                        // TODO: handle encryption at this level
-                        CHECK_FAIL("TODO: encryption");
-                    }
                     receiver_state->left_to_read -= can_copy;
                     data += can_copy;
                     len -= can_copy;
@@ -95,23 +181,22 @@ err_t receiver_consume_data(client_t* client, uint8_t* data, size_t len) {
                 }
             }
 
-            // handle decompression now
-            if (receiver_state->compression) {
-                // TODO: now handle compression
-                CHECK_FAIL("TODO: compression");
-            }
-
-            // now pass the packet for dispatching
-            CHECK_AND_RETHROW(dispatch_packet(client, receiver_state->packet, receiver_state->packet_length));
+            CHECK_AND_RETHROW(handle_packet(client, receiver_state->packet, receiver_state->packet_length));
 
             // we no longer have a use for this packet, return it if
             // it was allocated from the data pool
             if (receiver_state->should_return) {
-                buffer_pool_return_protocol_send(receiver_state->packet);
+                buffer_pool_free(receiver_state->packet);
                 receiver_state->packet = NULL;
                 receiver_state->should_return = false;
             }
 
+            // the packet enabled encryption, everything after it is encrypted
+            if (receiver_state->encryption && !decrypted) {
+                aes_cfb8_decrypt(&receiver_state->cipher, data, len);
+                decrypted = true;
+            }
+
             // we are done! reset the state and process the packet
             receiver_state->line = 0;
         FETCHER_END
@@ -121,14 +206,99 @@ cleanup:
     if (IS_ERROR(err)) {
         // free any data we may have allocated
         if (receiver_state->should_return) {
-            buffer_pool_return_protocol_send(receiver_state->packet);
+            buffer_pool_free(receiver_state->packet);
             receiver_state->packet = NULL;
             receiver_state->should_return = false;
         }
-
         // reset the receiver state
         receiver_state->line = 0;
     }
 
     return err;
 }
+
+err_t receiver_start_ring(client_t* client) {
+    err_t err = NO_ERROR;
+    receiver_state_t* receiver_state = &client->receiver_state;
+    recv_ring_t* ring = &receiver_state->ring;
+
+    // room for the largest packet and its length
+    CHECK_AND_RETHROW(init_recv_ring(ring, g_server_config.max_recv_packet_size + 5));
+
+    if (receiver_state->line == 0) {
+        // nothing was partially received
+        goto cleanup;
+    }
+
+    // put what we already have of the packet back into the
+    // ring, it was already decrypted
+    uint8_t* out = recv_ring_write_ptr(ring);
+    if (receiver_state->should_return) {
+        // we have the length and some of the data
+        int received = receiver_state->packet_length - receiver_state->left_to_read;
+        int length_size = protocol_write_varint(out, 5, receiver_state->packet_length);
+        memcpy(out + length_size, receiver_state->packet, received);
+        ring->tail += length_size + received;
+
+        buffer_pool_free(receiver_state->packet);
+        receiver_state->packet = NULL;
+        receiver_state->should_return = false;
+    } else {
+        // we are in the middle of the length, all the bytes
+        // we got so far had the continuation bit set
+        for (int i = 0; i < receiver_state->varint.length; i++) {
+            out[i] = ((receiver_state->packet_length >> (i * 7)) & 0x7F) | 0x80;
+        }
+        ring->tail += receiver_state->varint.length;
+    }
+    receiver_state->line = 0;
+
+cleanup:
+    return err;
+}
+
+err_t receiver_consume_ring(client_t* client, size_t len) {
+    err_t err = NO_ERROR;
+    receiver_state_t* receiver_state = &client->receiver_state;
+    recv_ring_t* ring = &receiver_state->ring;
+
+    // the new data is right at the tail
+    if (receiver_state->encryption) {
+        aes_cfb8_decrypt(&receiver_state->cipher, recv_ring_write_ptr(ring), len);
+    }
+    ring->tail += len;
+
+    // dispatch every packet we have in full, even ones that
+    // wrap around the end of the ring are contiguous
+    while (true) {
+        size_t available = recv_ring_used(ring);
+        uint8_t* data = recv_ring_read_ptr(ring);
+
+        frame_t frames[BATCH_FRAMES];
+        size_t consumed = 0;
+        int count = framer_scan(data, available, g_server_config.max_recv_packet_size, frames, BATCH_FRAMES, &consumed);
+        for (int i = 0; i < count; i++) {
+            CHECK_AND_RETHROW(handle_packet(client, data + frames[i].offset, frames[i].length));
+        }
+        ring->head += consumed;
+
+        if (count < BATCH_FRAMES) {
+            break;
+        }
+    }
+
+    // the framer stops at anything it can't frame, make sure it is only
+    // because the rest of the packet was not received yet
+    size_t available = recv_ring_used(ring);
+    uint8_t* data = recv_ring_read_ptr(ring);
+    uint32_t packet_length = 0;
+    int read_size = framer_read_length(data, available, &packet_length);
+    CHECK_ERROR(read_size >= 0, ERROR_PROTOCOL, "Packet length was not a valid varint");
+    if (read_size > 0) {
+        CHECK_ERROR(packet_length <= g_server_config.max_recv_packet_size, ERROR_PROTOCOL,
+                    "Client tried to send packet larger than supported (wanted %u)", packet_length);
+    }
+
+cleanup:
+    return err;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <minecraft/protocol/protocol.h>
+#include <net/aes_cfb8.h>
+#include <net/recv_ring.h>
 #include <lib/except.h>
 #include <stdbool.h>
 
@@ -11,7 +13,6 @@ typedef struct receiver_state {
     // varint fetching
     int line;
     struct {
-        uint8_t current_byte;
         uint8_t length;
     } varint;
 
@@ -20,12 +21,48 @@ typedef struct receiver_state {
     uint8_t* packet;
     bool should_return;
 
+    // the inflated packet, when compression is enabled
+    uint8_t* decompressed;
+
     // the phase of the protocol (decides which state machine
     // we are going through)
     bool compression;
     bool encryption;
+
+    // the stream cipher, the data is decrypted in place
+    // in the recv buffer as it arrives
+    aes_cfb8_t cipher;
+
+    // the receive ring of the client, once it has one the data is
+    // received straight into it instead of the shared recv buffers
+    recv_ring_t ring;
 } receiver_state_t;
 
 struct client;
 
-err_t receiver_consume_data(struct client* receiver_state, uint8_t* data, size_t len);
+/**
+ * Consume data that was received into a recv buffer, the packets that fit in
+ * the buffer are dispatched in place and the rest are copied out of it
+ *
+ * @param client    [IN] The client
+ * @param data      [IN] The data
+ * @param len       [IN] The size of the data
+ */
+err_t receiver_consume_data(struct client* client, uint8_t* data, size_t len);
+
+/**
+ * Move the client to a receive ring, a packet that was partially received
+ * is moved to the ring as well
+ *
+ * @param client    [IN] The client
+ */
+err_t receiver_start_ring(struct client* client);
+
+/**
+ * Consume data that was received at the end of the receive ring, every
+ * complete packet is dispatched right from the ring
+ *
+ * @param client    [IN] The client
+ * @param len       [IN] The amount of bytes that were received
+ */
+err_t receiver_consume_ring(struct client* client, size_t len);
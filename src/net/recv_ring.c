@@ -0,0 +1,47 @@
+#include "recv_ring.h"
+
+#include <lib/defs.h>
+
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+
+err_t init_recv_ring(recv_ring_t* ring, size_t min_size) {
+    err_t err = NO_ERROR;
+    int fd = -1;
+    uint8_t* data = MAP_FAILED;
+
+    size_t size = ALIGN_UP(min_size, PAGE_SIZE);
+
+    // the memory of the ring, the pages are only allocated once touched
+    fd = memfd_create("recv_ring", MFD_CLOEXEC);
+    CHECK_ERRNO(fd >= 0);
+    CHECK_ERRNO(ftruncate(fd, size) == 0);
+
+    // reserve room for both mappings, and map the memory twice into it
+    data = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK_ERRNO(data != MAP_FAILED);
+    CHECK_ERRNO(mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED);
+    CHECK_ERRNO(mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED);
+
+    ring->data = data;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    data = MAP_FAILED;
+
+cleanup:
+    // the mappings keep the memory alive
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (data != MAP_FAILED) {
+        munmap(data, size * 2);
+    }
+    return err;
+}
+
+void free_recv_ring(recv_ring_t* ring) {
+    munmap(ring->data, ring->size * 2);
+    memset(ring, 0, sizeof(*ring));
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <lib/except.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A receive ring mapped twice back to back, so the byte right after the end
+ * of the ring is the first byte of the ring again. Anything in the ring can be
+ * accessed as one contiguous range even if it wraps around the end, so packets
+ * are received straight into it and dispatched from it without any copying
+ */
+typedef struct recv_ring {
+    // the start of the ring, the size bytes after the ring
+    // are the same memory as the ring itself
+    uint8_t* data;
+    size_t size;
+
+    // the read and write positions, they only ever go up
+    // and are wrapped when accessing the ring
+    uint64_t head;
+    uint64_t tail;
+} recv_ring_t;
+
+/**
+ * Create the ring
+ *
+ * @param ring      [IN] The ring
+ * @param min_size  [IN] The least amount of bytes the ring must hold, rounded up to pages
+ */
+err_t init_recv_ring(recv_ring_t* ring, size_t min_size);
+
+/**
+ * Unmap the ring
+ *
+ * @param ring      [IN] The ring
+ */
+void free_recv_ring(recv_ring_t* ring);
+
+/**
+ * Where the unread data starts
+ */
+static inline uint8_t* recv_ring_read_ptr(recv_ring_t* ring) {
+    return ring->data + ring->head % ring->size;
+}
+
+/**
+ * Where new data is written to, the free space is contiguous from here
+ */
+static inline uint8_t* recv_ring_write_ptr(recv_ring_t* ring) {
+    return ring->data + ring->tail % ring->size;
+}
+
+/**
+ * The amount of unread bytes in the ring
+ */
+static inline size_t recv_ring_used(recv_ring_t* ring) {
+    return ring->tail - ring->head;
+}
+
+/**
+ * The amount of bytes that can be written to the ring
+ */
+static inline size_t recv_ring_free(recv_ring_t* ring) {
+    return ring->size - recv_ring_used(ring);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <net/compression_worker.h>
+#include <net/send_queue.h>
+#include <lib/list.h>
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct client;
+struct server_work;
+struct server_broadcast;
+
+typedef enum request_type {
+    REQUEST_ACCEPT,
+    REQUEST_RECV,
+    REQUEST_SEND,
+    REQUEST_COMPRESS,
+    REQUEST_BROADCAST,
+    REQUEST_WORK,
+    REQUEST_TIMER,
+    REQUEST_WAKE,
+    REQUEST_CLOSE
+} request_type_t;
+
+/**
+ * The context of an op submitted to the ring of a reactor, the completion
+ * carries a pointer to it in its user data. The recv and the send of a client
+ * use the contexts embedded in the client, everything else takes one from the
+ * pool of the reactor
+ */
+typedef struct request {
+    // the type of the request
+    request_type_t type;
+
+    // the request is embedded in a client and never goes to the pool
+    bool embedded;
+
+    // the next free request in the pool of the reactor
+    struct request* next_free;
+
+    union {
+        struct {
+            // the file slot the socket goes into, and the address
+            // of the peer which the kernel fills in
+            int slot;
+            struct sockaddr_in address;
+            socklen_t address_len;
+        } accept;
+
+        struct {
+            struct client* client;
+        } recv;
+
+        struct {
+            // the client that is sending
+            struct client* client;
+
+            // for zero copy sends the segments are referenced by the
+            // request until the kernel notifies us it is done with them
+            send_segment_t* segments[SEND_QUEUE_MAX_IOVS];
+            int segment_count;
+            bool zero_copy;
+        } send;
+
+        struct {
+            // the client the packet is sent to, the packet waits
+            // on its pending sends until all before it are done
+            struct client* client;
+            list_node_t node;
+
+            // the packet, compressed and framed by a worker unless
+            // it was small enough to be framed right away
+            compression_job_t job;
+            bool done;
+
+            // a broadcast waiting behind the other packets, the
+            // request holds a reference to it instead of a job
+            send_shared_t* shared;
+
+            // a broadcast still being compressed for the reactor, the
+            // request waits on it until the frame is set
+            list_node_t wait_node;
+
+            // how to queue the packet once it is done
+            send_policy_t policy;
+            uint64_t merge_key;
+        } compress;
+
+        struct {
+            // the broadcast being compressed by a worker, the request
+            // holds a reference to it until the frame is done
+            struct server_broadcast* broadcast;
+            compression_job_t job;
+        } broadcast;
+
+        struct {
+            struct server_work* work;
+        } work;
+
+        struct {
+            // the file slot of a freed client, it is only reused
+            // once the socket in it is closed
+            int slot;
+        } close;
+    };
+} request_t;
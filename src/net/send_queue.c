@@ -0,0 +1,266 @@
+#include "send_queue.h"
+
+#include "buffer_pool.h"
+#include "server.h"
+
+#include <lib/stb_ds.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// the segment and the largest framing must fit in the headroom
+_Static_assert(sizeof(send_segment_t) + 5 * 2 <= SERVER_SEND_HEADROOM, "Send headroom is too small");
+_Static_assert(sizeof(send_shared_t) + 5 * 2 <= SERVER_SEND_HEADROOM, "Send headroom is too small");
+
+static void link_segment(send_queue_t* queue, send_segment_t* segment) {
+    if (queue->tail == NULL) {
+        queue->head = segment;
+    } else {
+        queue->tail->next = segment;
+    }
+    queue->tail = segment;
+}
+
+/**
+ * Overwrite the previous unsent frame with the same key, if there is one
+ */
+static bool try_merge(send_queue_t* queue, uint64_t key, const uint8_t* frame, size_t frame_size) {
+    send_merge_entry_t* entry = hmgetp_null(queue->merge_table, key);
+    if (entry != NULL && entry->value.flush == queue->flush_count && entry->value.size == frame_size) {
+        memcpy(entry->value.segment->data + entry->value.offset, frame, frame_size);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Remember the frame that was just pushed for merging, it is at the end of the tail
+ */
+static void remember_merge(send_queue_t* queue, uint64_t key, size_t frame_size) {
+    send_segment_t* tail = queue->tail;
+    send_merge_entry_t new_entry = {
+        .key = key,
+        .value = {
+            .segment = tail,
+            .offset = tail->size - frame_size,
+            .size = frame_size,
+            .flush = queue->flush_count
+        }
+    };
+    hmputs(queue->merge_table, new_entry);
+}
+
+void send_queue_enable_encryption(send_queue_t* queue, const uint8_t secret[16]) {
+    // whatever was queued before this point is not encrypted
+    for (send_segment_t* segment = queue->head; segment != NULL; segment = segment->next) {
+        segment->encrypted = segment->size;
+    }
+
+    aes_cfb8_init(&queue->cipher, secret, secret);
+    queue->encryption = true;
+}
+
+void send_queue_push(send_queue_t* queue, uint8_t* buffer, uint8_t* frame, size_t frame_size) {
+    send_segment_t* tail = queue->tail;
+    queue->queued_bytes += frame_size;
+
+    if (frame_size <= SEND_QUEUE_COPY_LIMIT && tail != NULL && tail->capacity - tail->size >= frame_size) {
+        // small frame and we have room in the tail, coalesce it with
+        // the rest of the frames and give the buffer back right away
+        memcpy(tail->data + tail->size, frame, frame_size);
+        tail->size += frame_size;
+        buffer_pool_return_protocol_send(buffer);
+        return;
+    }
+
+    // turn the buffer itself into a segment, the rest of the buffer
+    // after the frame can be used for coalescing the next frames
+    send_segment_t* segment = (send_segment_t*)buffer;
+    segment->next = NULL;
+    segment->data = frame;
+    segment->size = frame_size;
+    segment->capacity = (buffer + buffer_pool_size(buffer)) - frame;
+    segment->sent = 0;
+    segment->encrypted = 0;
+    segment->refs = 1;
+    segment->shared = NULL;
+    link_segment(queue, segment);
+}
+
+bool send_queue_push_copy(send_queue_t* queue, const uint8_t* frame, size_t frame_size) {
+    send_segment_t* tail = queue->tail;
+    if (tail != NULL && tail->capacity - tail->size >= frame_size) {
+        // there is room, just append to the tail
+        memcpy(tail->data + tail->size, frame, frame_size);
+        tail->size += frame_size;
+        queue->queued_bytes += frame_size;
+        return true;
+    }
+
+    // copy it to a new buffer and push that instead, with some
+    // room after it for coalescing the next frames
+    size_t size = SERVER_SEND_HEADROOM + frame_size;
+    uint8_t* buffer = buffer_pool_alloc(size > SEND_QUEUE_COPY_SEGMENT_SIZE ? size : SEND_QUEUE_COPY_SEGMENT_SIZE);
+    if (buffer == NULL) {
+        return false;
+    }
+    memcpy(buffer + SERVER_SEND_HEADROOM, frame, frame_size);
+    send_queue_push(queue, buffer, buffer + SERVER_SEND_HEADROOM, frame_size);
+    return true;
+}
+
+bool send_queue_push_merge(send_queue_t* queue, uint64_t key, uint8_t* buffer, uint8_t* frame, size_t frame_size) {
+    // check if we have an older frame that was not flushed yet
+    if (try_merge(queue, key, frame, frame_size)) {
+        buffer_pool_return_protocol_send(buffer);
+        return true;
+    }
+
+    // push it normally and remember where it went, it either got
+    // coalesced to the end of the tail or became the new tail
+    send_queue_push(queue, buffer, frame, frame_size);
+    remember_merge(queue, key, frame_size);
+
+    return false;
+}
+
+bool send_queue_push_shared(send_queue_t* queue, send_shared_t* shared) {
+    if (queue->encryption || shared->frame_size <= SEND_QUEUE_COPY_LIMIT) {
+        // it is either cheaper to copy it or we need our own
+        // copy to encrypt it in place
+        return send_queue_push_copy(queue, shared->frame, shared->frame_size);
+    }
+
+    // reference the frame from a segment of its own, nothing can
+    // be coalesced into it since it has no room
+    send_segment_t* segment = malloc(sizeof(send_segment_t));
+    if (segment == NULL) {
+        return false;
+    }
+    atomic_fetch_add_explicit(&shared->refs, 1, memory_order_relaxed);
+    segment->next = NULL;
+    segment->data = shared->frame;
+    segment->size = shared->frame_size;
+    segment->capacity = shared->frame_size;
+    segment->sent = 0;
+    segment->encrypted = 0;
+    segment->refs = 1;
+    segment->shared = shared;
+    link_segment(queue, segment);
+    queue->queued_bytes += shared->frame_size;
+
+    return true;
+}
+
+bool send_queue_push_shared_merge(send_queue_t* queue, uint64_t key, send_shared_t* shared, bool* merged) {
+    *merged = try_merge(queue, key, shared->frame, shared->frame_size);
+    if (*merged) {
+        return true;
+    }
+
+    if (!send_queue_push_shared(queue, shared)) {
+        return false;
+    }
+
+    // only a copy can be overwritten later, and a copy
+    // always ends up in a tail of our own
+    if (queue->tail->shared == NULL) {
+        remember_merge(queue, key, shared->frame_size);
+    }
+
+    return true;
+}
+
+int send_queue_prepare(send_queue_t* queue, send_segment_t** segments) {
+    int count = 0;
+    size_t total = 0;
+
+    // everything that is queued is about to be flushed, so merging
+    // into any of it is no longer allowed
+    queue->flush_count++;
+
+    for (send_segment_t* segment = queue->head; segment != NULL && count < SEND_QUEUE_MAX_IOVS; segment = segment->next) {
+        size_t left = segment->size - segment->sent;
+        if (left == 0) {
+            continue;
+        }
+
+        // encrypt whatever was added since the last time, segments are
+        // always prepared in order so this keeps the stream in order
+        if (segment->encrypted != segment->size) {
+            if (queue->encryption) {
+                aes_cfb8_encrypt(&queue->cipher, segment->data + segment->encrypted, segment->size - segment->encrypted);
+            }
+            segment->encrypted = segment->size;
+        }
+
+        queue->iovs[count].iov_base = segment->data + segment->sent;
+        queue->iovs[count].iov_len = left;
+        segments[count] = segment;
+        total += left;
+        count++;
+    }
+
+    queue->msg = (struct msghdr){
+        .msg_iov = queue->iovs,
+        .msg_iovlen = count,
+    };
+    queue->in_flight = total;
+
+    return count;
+}
+
+void send_queue_consume(send_queue_t* queue, size_t sent) {
+    queue->queued_bytes -= sent;
+    queue->in_flight = 0;
+
+    while (sent > 0 && queue->head != NULL) {
+        send_segment_t* segment = queue->head;
+        size_t left = segment->size - segment->sent;
+
+        if (sent < left) {
+            // short send, continue from here next time
+            segment->sent += sent;
+            break;
+        }
+
+        // the segment was fully sent, drop it
+        sent -= left;
+        queue->head = segment->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+        send_segment_put(segment);
+    }
+}
+
+void send_queue_clear(send_queue_t* queue) {
+    send_segment_t* segment = queue->head;
+    while (segment != NULL) {
+        send_segment_t* next = segment->next;
+        send_segment_put(segment);
+        segment = next;
+    }
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->queued_bytes = 0;
+    queue->in_flight = 0;
+    hmfree(queue->merge_table);
+}
+
+void send_segment_put(send_segment_t* segment) {
+    if (--segment->refs == 0) {
+        if (segment->shared != NULL) {
+            send_shared_put(segment->shared);
+            free(segment);
+        } else {
+            buffer_pool_return_protocol_send(segment);
+        }
+    }
+}
+
+void send_shared_put(send_shared_t* shared) {
+    if (atomic_fetch_sub_explicit(&shared->refs, 1, memory_order_acq_rel) == 1) {
+        buffer_pool_return_protocol_send(shared);
+    }
+}
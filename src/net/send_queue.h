@@ -0,0 +1,256 @@
+#pragma once
+
+#include <lib/except.h>
+#include <net/aes_cfb8.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The max amount of segments that are sent in a single flush
+ */
+#define SEND_QUEUE_MAX_IOVS 16
+
+/**
+ * Frames up to this size are copied into the tail of the queue, anything
+ * larger keeps its own buffer as a segment so it is never copied
+ */
+#define SEND_QUEUE_COPY_LIMIT 2048
+
+/**
+ * Copied frames that don't fit in the tail get a new buffer of at least this
+ * size (including the headroom), so the frames after them fit in it too
+ */
+#define SEND_QUEUE_COPY_SEGMENT_SIZE (16 * 1024)
+
+/**
+ * How a packet should be treated when the client is falling behind
+ */
+typedef enum send_policy {
+    /**
+     * The packet is always sent
+     */
+    SEND_NORMAL,
+
+    /**
+     * The packet is dropped once the client is over the soft limit
+     */
+    SEND_DROPPABLE,
+
+    /**
+     * The packet supersedes the previous unsent packet with the same merge
+     * key (for example the position of an entity), so it replaces it
+     */
+    SEND_MERGEABLE,
+} send_policy_t;
+
+/**
+ * A frame that is sent as is to many clients, it is never written to once
+ * created. The header lives at the start of the send buffer holding the frame
+ */
+typedef struct send_shared {
+    // a reference for every segment using it and one for its creator, segments
+    // of clients on any reactor can reference it
+    atomic_int refs;
+
+    // was the frame compressed
+    bool compressed;
+
+    // the frame inside the buffer
+    uint8_t* frame;
+    size_t frame_size;
+} send_shared_t;
+
+/**
+ * A segment of the send queue, the header lives at the start of the
+ * send buffer (inside the headroom) so it needs no allocation of its own,
+ * unless the segment references a shared frame
+ */
+typedef struct send_segment {
+    // the next segment in the queue
+    struct send_segment* next;
+
+    // the data of the segment, this is the start of the first frame
+    uint8_t* data;
+
+    // the amount of bytes written to the segment
+    uint32_t size;
+
+    // the amount of bytes that can be written from the data
+    uint32_t capacity;
+
+    // the amount of bytes that were already sent
+    uint32_t sent;
+
+    // the amount of bytes that were already encrypted, bytes
+    // are encrypted right before they are first sent
+    uint32_t encrypted;
+
+    // the queue holds a reference, and every zero copy send
+    // that still uses the data holds another one
+    int refs;
+
+    // the shared frame the data belongs to, the segment
+    // holds a reference to it and has no buffer of its own
+    send_shared_t* shared;
+} send_segment_t;
+
+/**
+ * Where the last packet with a merge key was queued, it can be overwritten
+ * in place as long as it was not part of a flush yet
+ */
+typedef struct send_merge_entry {
+    uint64_t key;
+    struct {
+        send_segment_t* segment;
+        size_t offset;
+        size_t size;
+        size_t flush;
+    } value;
+} send_merge_entry_t;
+
+typedef struct send_queue {
+    // the segments, sent from the head and appended at the tail
+    send_segment_t* head;
+    send_segment_t* tail;
+
+    // the amount of bytes in the queue that were not sent yet
+    size_t queued_bytes;
+
+    // the unsent mergeable packets, entries from before the
+    // last flush are stale and ignored
+    send_merge_entry_t* merge_table;
+    size_t flush_count;
+
+    // the amount of bytes that are currently being sent
+    size_t in_flight;
+
+    // the message used for sending the queue, only a single
+    // send is in flight at a time so we can keep it here
+    struct iovec iovs[SEND_QUEUE_MAX_IOVS];
+    struct msghdr msg;
+
+    // the stream cipher, everything is encrypted in place
+    // in the send buffers as it is prepared for sending
+    bool encryption;
+    aes_cfb8_t cipher;
+} send_queue_t;
+
+/**
+ * Start encrypting everything that is pushed from now on, what is already
+ * queued is sent as is
+ *
+ * @param queue     [IN] The queue
+ * @param secret    [IN] The shared secret, used both as the key and the iv
+ */
+void send_queue_enable_encryption(send_queue_t* queue, const uint8_t secret[16]);
+
+/**
+ * Push a frame to the end of the queue, the queue takes ownership of the send buffer
+ *
+ * @param queue         [IN] The queue
+ * @param buffer        [IN] The send buffer holding the frame
+ * @param frame         [IN] The frame inside the buffer
+ * @param frame_size    [IN] The size of the frame
+ */
+void send_queue_push(send_queue_t* queue, uint8_t* buffer, uint8_t* frame, size_t frame_size);
+
+/**
+ * Push a copy of a frame to the end of the queue, the frame is copied into the
+ * tail if there is room or into a new send buffer otherwise
+ *
+ * @param queue         [IN] The queue
+ * @param frame         [IN] The frame to copy
+ * @param frame_size    [IN] The size of the frame, must fit in a send buffer after the headroom
+ *
+ * @return false if no send buffer could be allocated
+ */
+bool send_queue_push_copy(send_queue_t* queue, const uint8_t* frame, size_t frame_size);
+
+/**
+ * Push a frame that supersedes the previous unsent frame with the same key, if
+ * that frame was not flushed yet and has the same size it is overwritten in place
+ * and the new buffer is returned to the pool, otherwise the frame is pushed normally
+ *
+ * @param queue         [IN] The queue
+ * @param key           [IN] The merge key of the frame
+ * @param buffer        [IN] The send buffer holding the frame
+ * @param frame         [IN] The frame inside the buffer
+ * @param frame_size    [IN] The size of the frame
+ *
+ * @return true if the frame was merged into an existing one
+ */
+bool send_queue_push_merge(send_queue_t* queue, uint64_t key, uint8_t* buffer, uint8_t* frame, size_t frame_size);
+
+/**
+ * Push a shared frame to the end of the queue, small frames are copied into the tail. Large
+ * frames are referenced by a segment of their own, unless the queue is encrypted (the data is
+ * encrypted in place) in which case they are copied as well
+ *
+ * @param queue     [IN] The queue
+ * @param shared    [IN] The shared frame, must fit in a send buffer after the headroom
+ *
+ * @return false if no memory could be allocated
+ */
+bool send_queue_push_shared(send_queue_t* queue, send_shared_t* shared);
+
+/**
+ * Push a shared frame that supersedes the previous unsent frame with the same key, like
+ * send_queue_push_merge. A shared frame that ends up referenced is never overwritten, so
+ * it is not remembered for merging
+ *
+ * @param queue     [IN]    The queue
+ * @param key       [IN]    The merge key of the frame
+ * @param shared    [IN]    The shared frame
+ * @param merged    [OUT]   Was the frame merged into an existing one
+ *
+ * @return false if no memory could be allocated
+ */
+bool send_queue_push_shared_merge(send_queue_t* queue, uint64_t key, send_shared_t* shared, bool* merged);
+
+/**
+ * Prepare the message for sending everything that is queued, the segments
+ * that are part of the message are returned so they can be referenced
+ *
+ * @param queue     [IN]    The queue
+ * @param segments  [OUT]   The segments of the message, SEND_QUEUE_MAX_IOVS entries
+ *
+ * @return The amount of segments in the message, 0 if there is nothing to send
+ */
+int send_queue_prepare(send_queue_t* queue, send_segment_t** segments);
+
+/**
+ * Mark bytes of the in flight message as sent, the rest of the message is
+ * going to be sent in the next prepare
+ *
+ * @param queue     [IN] The queue
+ * @param sent      [IN] The amount of bytes that were sent
+ */
+void send_queue_consume(send_queue_t* queue, size_t sent);
+
+/**
+ * Drop everything that is queued, and free the merge table
+ *
+ * @param queue     [IN] The queue
+ */
+void send_queue_clear(send_queue_t* queue);
+
+/**
+ * Release a reference to the segment, the send buffer is returned
+ * once no one references it
+ *
+ * @param segment   [IN] The segment
+ */
+void send_segment_put(send_segment_t* segment);
+
+/**
+ * Release a reference to the shared frame, its send buffer is
+ * returned once no one references it
+ *
+ * @param shared    [IN] The shared frame
+ */
+void send_shared_put(send_shared_t* shared);
@@ -1,107 +1,391 @@
 #include "server.h"
 #include "client.h"
 #include "buffer_pool.h"
+#include "send_queue.h"
+#include "admission.h"
+#include "compression.h"
+#include "compression_worker.h"
+#include "compression_control.h"
+#include "timer_wheel.h"
+#include "framing.h"
+#include "request.h"
 
 #include <netinet/in.h>
 #include <strings.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <lib/stb_ds.h>
 #include <net/receiver.h>
-#include <sync/spin_lock.h>
-
-typedef enum request_type {
-    REQUEST_ACCEPT,
-    REQUEST_RECV,
-    REQUEST_SEND
-} request_type_t;
-
-typedef struct request {
-    // the type of the request
-    request_type_t type;
-
-    union {
-        struct {
-            client_t* client;
-        } recv;
-
-        struct {
-            // the client that is sending
-            client_t* client;
-
-            // for sending we have a bit more
-            // data for a nicer send state
-            struct iovec vecs[3];
-            size_t vecs_count;
-
-            // and additionally we have a data
-            // for the varints that need to be sent
-            uint8_t varint_temp[5 * 2];
-        } send;
-
-        struct {
-            // the address of the accepted socket
-            struct sockaddr client_addr;
-            socklen_t client_addr_len;
-        } accept;
-    };
-} request_t;
+#include <minecraft_protodef.h>
+#include <minecraft/tick_arena.h>
+#include <sync/spsc_queue.h>
+
+/**
+ * The buffer group id used for the recv buffer ring
+ */
+#define RECV_BUFFER_GROUP 0
+
+/**
+ * The packet id of the play keep alive, the play
+ * packets are not generated yet
+ */
+#define PLAY_KEEP_ALIVE_ID 0x21
+
+/**
+ * The amount of requests preallocated for every connection of a reactor, on top
+ * of the recv and send embedded in the client. These are for the zero copy sends
+ * waiting on their notification, the packets waiting on a compression worker and
+ * the close of the socket once the client is freed
+ */
+#define REQUESTS_PER_CONNECTION 3
+
+/**
+ * The amount of accepts every reactor keeps in flight, each one takes a free
+ * file slot up front that the kernel installs the new socket in
+ */
+#define ACCEPTS_IN_FLIGHT 4
+
+/**
+ * The amount of requests added to the pool if it ever runs out
+ */
+#define REQUEST_POOL_GROW 64
+
+/**
+ * The ops of a client use the requests embedded in it, and their user data holds
+ * a handle to the client instead of a pointer: the slot of the client in the low
+ * 32 bits, the low bits of its generation above it and the type of the op. The top
+ * bit tells it apart from the pointer of a pooled request
+ */
+#define USER_DATA_CLIENT                (1ull << 63)
+#define USER_DATA_TYPE_SHIFT            56
+#define USER_DATA_GENERATION_SHIFT      32
+#define USER_DATA_GENERATION_MASK       0xFFFFFFull
+
+typedef enum game_send_type {
+    GAME_SEND_PACKET,
+    GAME_SEND_BROADCAST,
+    GAME_SEND_DISCONNECT,
+} game_send_type_t;
+
+/**
+ * Something the game tick wants done with a client, queued for its reactor
+ */
+typedef struct game_send {
+    game_send_type_t type;
+    client_handle_t client;
+
+    // the packet to send, same as for server_send_packet
+    uint8_t* buffer;
+    int32_t size;
+    send_policy_t policy;
+    uint64_t merge_key;
+
+    // the broadcast to send instead, the entry holds a reference to it
+    server_broadcast_t* broadcast;
+} game_send_t;
+
+/**
+ * The compressed frame of a broadcast for a single reactor, only touched by that
+ * reactor. Every reactor compresses the packet on its own, so none of them ever
+ * waits on another one
+ */
+typedef struct broadcast_frame {
+    // the frame, NULL until the first client with compression needs it
+    send_shared_t* shared;
+
+    // the frame is being compressed by a worker, the pending
+    // sends of the clients waiting on it are linked here
+    bool compressing;
+    list_t waiting;
+} broadcast_frame_t;
+
+struct server_broadcast {
+    // a reference for the creator, for every game send of it
+    // and for every compression of it that is in flight
+    atomic_int refs;
+
+    // the frame for clients without compression, the packet with its length
+    // written in the headroom. The compressed frames are made from the packet
+    send_shared_t* frame;
+    uint8_t* packet;
+    int32_t size;
+
+    // the compressed frames, indexed by the reactor
+    broadcast_frame_t compressed[];
+};
+
+typedef struct reactor {
+    /**
+     * The index of the reactor
+     */
+    int id;
+
+    /**
+     * The listening socket of this reactor, all the reactors bind
+     * to the same port with SO_REUSEPORT and the kernel balances
+     * the new connections between them
+     */
+    int server_socket;
+
+    /**
+     * The io uring of this reactor, only the reactor thread
+     * is allowed to touch it
+     */
+    struct io_uring ring;
+
+    /**
+     * The provided buffer ring used for recv, the kernel only picks a buffer
+     * from it once data actually arrives on a socket, so idle clients don't
+     * hold any recv memory
+     */
+    struct io_uring_buf_ring* recv_buffer_ring;
+    uint8_t* recv_buffers;
+
+    /**
+     * The free slots in the registered file table of the ring, client sockets
+     * are installed in it so the ops on them don't need to look up the file.
+     * A client takes the slot with the same index in the client slab
+     */
+    int* free_file_slots;
+
+    /**
+     * The accepts in flight, they are armed again whenever there
+     * are free slots to accept into
+     */
+    int accepts_in_flight;
+
+    /**
+     * Are the send buffers of the pool registered as fixed buffers
+     */
+    bool send_buffers_registered;
+
+    /**
+     * The network clients owned by this reactor, allocated up front with a slot
+     * for every entry of the file table. Live clients are the ones in use
+     */
+    client_t* clients;
+    int client_capacity;
+
+    /**
+     * Clients that have queued data which was not flushed yet
+     */
+    list_t dirty_clients;
+
+    /**
+     * The deadlines of all the clients, the wheel is advanced by a
+     * timeout that fires every tick of it
+     */
+    timer_wheel_t timers;
+    struct __kernel_timespec timer_interval;
+
+    /**
+     * A pool of requests that can be used for submitting stuff to the io uring,
+     * they are allocated up front in a single array. Only the reactor thread
+     * submits to its ring, so the free list needs no lock
+     */
+    request_t* requests;
+    request_t* free_requests;
+
+    /**
+     * The queues between the reactor and the game tick, the reactor is the only
+     * producer of the packets and the game thread is the only producer of the
+     * sends. The eventfd wakes the reactor once the game tick queued anything
+     * for it, which the game thread tracks in wake_pending
+     */
+    spsc_queue_t game_packets;
+    spsc_queue_t game_sends;
+    int wake_fd;
+    uint64_t wake_value;
+    bool wake_pending;
+
+    /**
+     * Disconnects the game tick could not queue because the sends were full, only
+     * touched by the game thread. They are queued again on every flush until they
+     * fit, so a kick is never lost
+     */
+    client_handle_t* overflow_disconnects;
+
+    /**
+     * The thread running the reactor
+     */
+    thrd_t thread;
+
+    /**
+     * The stats of this reactor, only written by the reactor
+     * thread but can be read from any thread
+     */
+    struct {
+        atomic_size_t queued_bytes;
+        atomic_size_t peak_client_queued_bytes;
+        atomic_size_t dropped_packets;
+        atomic_size_t merged_packets;
+        atomic_size_t kicked_clients;
+    } stats;
+} reactor_t;
 
 /**
  * The default server config, if one is not provided this is used
  */
 static server_config_t m_default_config = {
     .port = 25565,
+    .reactor_count = 0,
     .max_connections = 4096,
     .max_server_list_pending = 512,
+    .max_pending_connections = 1024,
+    .connection_rate = 1000,
+    .connection_burst = 2000,
+    .connection_rate_per_address = 5,
+    .connection_burst_per_address = 20,
+    .status_rate = 2000,
+    .status_burst = 4000,
+    .status_rate_per_address = 5,
+    .status_burst_per_address = 10,
     .recv_buffer_size = 4096,
+    .recv_buffer_count = 1024,
     .max_recv_packet_size = 65536,
     .max_send_packet_size = 65536,
+    .send_zc_threshold = 16384,
+    .registered_send_buffers = 256,
+    .buffer_idle_limit = SIZE_64MB,
+    .huge_pages = false,
+    .game_queue_size = 16384,
+    .send_high_water = 65536,
+    .send_soft_limit = SIZE_256KB,
+    .send_hard_limit = SIZE_4MB,
+    .compression_threshold = 256,
+    .compression_level = 4,
+    .compression_level_min = 1,
+    .compression_level_max = 6,
+    .compression_threshold_max = 4096,
+    .compression_target_mspt = 25,
+    .compression_workers = 2,
+    .compression_offload_threshold = 8192,
+    .login_workers = 2,
+    .low_latency = false,
+    .sqpoll_cpu = -1,
+    .sqpoll_idle_ms = 1000,
+    .busy_poll_usec = 50,
+    .handshake_timeout_ms = 5000,
+    .status_timeout_ms = 10000,
+    .login_timeout_ms = 30000,
+    .read_timeout_ms = 30000,
+    .keep_alive_interval_ms = 15000,
 };
 
 /**
- * The server socket
+ * The amount of connections that are still in the handshaking or status
+ * phase, over all the reactors
+ */
+static atomic_int m_pending_connections = 0;
+
+/**
+ * The amount of clients in the play state, over all the reactors
  */
-static int m_server_socket = -1;
+static atomic_int m_playing_clients = 0;
 
 /**
  * IS the server running currently
  */
-static bool m_running = false;
+static atomic_bool m_running = false;
 
 /**
- * The io uring
+ * The reactors, each one runs on its own thread with its own
+ * ring, listening socket and clients
  */
-static struct io_uring m_ring = { 0 };
+static reactor_t* m_reactors = NULL;
 
 /**
- * The network clients
+ * The reactor running on this thread, NULL outside of the reactors
  */
-static list_t m_clients = INIT_LIST(&m_clients);
+static thread_local reactor_t* m_current_reactor = NULL;
 
 server_config_t g_server_config = { 0 };
 
 /**
- * A pool of requests that can be used for submitting
- * stuff to the io uring
+ * Update a stat of the reactor, only the reactor thread writes
+ * its stats so there is no need for an atomic add
  */
-static request_t** m_requests_pool = NULL;
+static void stat_add(atomic_size_t* stat, ssize_t value) {
+    atomic_store_explicit(stat, atomic_load_explicit(stat, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static void stat_max(atomic_size_t* stat, size_t value) {
+    if (value > atomic_load_explicit(stat, memory_order_relaxed)) {
+        atomic_store_explicit(stat, value, memory_order_relaxed);
+    }
+}
+
+int server_playing_clients() {
+    return atomic_load_explicit(&m_playing_clients, memory_order_relaxed);
+}
+
+void server_get_default_config(server_config_t* config) {
+    *config = m_default_config;
+}
+
+void server_get_stats(server_stats_t* stats) {
+    *stats = (server_stats_t){ 0 };
+    for (int i = 0; i < g_server_config.reactor_count; i++) {
+        reactor_t* reactor = &m_reactors[i];
+        stats->queued_bytes += atomic_load_explicit(&reactor->stats.queued_bytes, memory_order_relaxed);
+        size_t peak = atomic_load_explicit(&reactor->stats.peak_client_queued_bytes, memory_order_relaxed);
+        if (peak > stats->peak_client_queued_bytes) {
+            stats->peak_client_queued_bytes = peak;
+        }
+        stats->dropped_packets += atomic_load_explicit(&reactor->stats.dropped_packets, memory_order_relaxed);
+        stats->merged_packets += atomic_load_explicit(&reactor->stats.merged_packets, memory_order_relaxed);
+        stats->kicked_clients += atomic_load_explicit(&reactor->stats.kicked_clients, memory_order_relaxed);
+    }
+}
 
 /**
- * Guards against concurrent sends
+ * The amount of cpus the reactors and poll threads are spread over
  */
-static spin_lock_t m_request_lock;
+static int online_cpus() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? cpus : 1;
+}
 
-err_t init_server(server_config_t* config) {
+/**
+ * The cpu the reactor thread is pinned to
+ */
+static int reactor_cpu(int id) {
+    return id % online_cpus();
+}
+
+/**
+ * The cpu the submission queue poll thread of the reactor is pinned to in low latency mode
+ */
+static int sqpoll_thread_cpu(server_config_t* config, int id) {
+    int first_cpu = config->sqpoll_cpu >= 0 ? config->sqpoll_cpu : config->reactor_count;
+    return (first_cpu + id) % online_cpus();
+}
+
+/**
+ * Setup a single reactor, this creates its listening socket and its ring
+ *
+ * @param reactor   [IN] The reactor to setup
+ * @param config    [IN] The server config
+ */
+static err_t init_reactor(reactor_t* reactor, server_config_t* config) {
     err_t err = NO_ERROR;
     int enable = 1;
 
-    if (config == NULL) {
-        config = &m_default_config;
-    }
-
-    // create the server socket
-    m_server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    CHECK_ERRNO(m_server_socket >= 0);
-    CHECK_ERRNO(0 == setsockopt(m_server_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)));
+    reactor->dirty_clients = INIT_LIST(&reactor->dirty_clients);
+    init_timer_wheel(&reactor->timers, timer_wheel_now());
+    reactor->timer_interval.tv_sec = 0;
+    reactor->timer_interval.tv_nsec = TIMER_WHEEL_TICK_MS * 1000000ll;
+
+    // create the server socket, every reactor has its own socket on the
+    // same port and the kernel will spread the connections between them
+    reactor->server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    CHECK_ERRNO(reactor->server_socket >= 0);
+    CHECK_ERRNO(0 == setsockopt(reactor->server_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)));
+    CHECK_ERRNO(0 == setsockopt(reactor->server_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)));
     struct sockaddr_in server_address = {
         .sin_family = AF_INET,
         .sin_port = htons(config->port),
@@ -109,240 +393,1827 @@ err_t init_server(server_config_t* config) {
             .s_addr = htons(INADDR_ANY)
         }
     };
-    CHECK_ERRNO(0 == bind(m_server_socket, (const struct sockaddr *)&server_address, sizeof(server_address)));
-    CHECK_ERRNO(0 == listen(m_server_socket, config->max_server_list_pending));
+    CHECK_ERRNO(0 == bind(reactor->server_socket, (const struct sockaddr *)&server_address, sizeof(server_address)));
+    CHECK_ERRNO(0 == listen(reactor->server_socket, config->max_server_list_pending));
+
+    // setup the io uring, each reactor only needs to hold its own share of the connections
+    int ret = 0;
+    int connections = config->max_connections / config->reactor_count + 1;
+    if (config->low_latency) {
+        // the poll thread gets a core of its own, init_server made
+        // sure it is not one any of the reactors runs on
+        struct io_uring_params params = {
+            .flags = IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF,
+            .sq_thread_cpu = sqpoll_thread_cpu(config, reactor->id),
+            .sq_thread_idle = config->sqpoll_idle_ms,
+        };
+        ret = io_uring_queue_init_params(connections, &reactor->ring, &params);
+        if (ret < 0) {
+            WARN("Failed to setup a polled ring for reactor #%d, falling back to a normal ring: %R", reactor->id, ret);
+        }
+    }
+    if (!config->low_latency || ret < 0) {
+        ret = io_uring_queue_init(connections, &reactor->ring, 0);
+        CHECK_ERROR(ret == 0, ret, "Failed to setup the ring");
+    }
 
-    // setup the io uring
-    CHECK_ERRNO(0 == io_uring_queue_init(config->max_connections + 1, &m_ring, 0));
+    if (config->low_latency) {
+        // busy poll the device queues of our sockets, the accepted sockets
+        // inherit the setting from the listening socket
+        int busy_poll = config->busy_poll_usec;
+        if (setsockopt(reactor->server_socket, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) != 0) {
+            WARN("Failed to enable busy polling on the server socket: %R", -errno);
+        }
 
-    // set the config
-    g_server_config = *config;
+        // the ring waits for the sockets itself, so it needs to busy poll as well
+        struct io_uring_napi napi = {
+            .busy_poll_to = config->busy_poll_usec,
+            .prefer_busy_poll = 1,
+        };
+        ret = io_uring_register_napi(&reactor->ring, &napi);
+        if (ret < 0) {
+            WARN("Failed to enable busy polling on the ring of reactor #%d: %R", reactor->id, ret);
+        }
+    }
+
+    // setup the registered file table for the client sockets
+    ret = io_uring_register_files_sparse(&reactor->ring, connections);
+    CHECK_ERROR(ret == 0, ret, "Failed to register the file table");
+    for (int i = connections - 1; i >= 0; i--) {
+        arrpush(reactor->free_file_slots, i);
+    }
+
+    // register the send buffers, this may fail if we are not allowed to lock
+    // that much memory, in which case we just won't use fixed buffers
+    struct iovec send_region;
+    if (buffer_pool_get_registered_send_region(&send_region)) {
+        ret = io_uring_register_buffers(&reactor->ring, &send_region, 1);
+        if (ret == 0) {
+            reactor->send_buffers_registered = true;
+        } else {
+            WARN("Failed to register the send buffers: %R", ret);
+        }
+    }
+
+    // allocate the memory for the recv buffers, all of them are in a single mapping
+    reactor->recv_buffers = mmap(NULL, config->recv_buffer_count * config->recv_buffer_size,
+                                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK_ERRNO(reactor->recv_buffers != MAP_FAILED);
+
+    // register the buffer ring and give all the buffers to the kernel
+    reactor->recv_buffer_ring = io_uring_setup_buf_ring(&reactor->ring, config->recv_buffer_count, RECV_BUFFER_GROUP, 0, &ret);
+    CHECK_ERROR(reactor->recv_buffer_ring != NULL, ret, "Failed to setup the recv buffer ring");
+    int mask = io_uring_buf_ring_mask(config->recv_buffer_count);
+    for (int i = 0; i < config->recv_buffer_count; i++) {
+        io_uring_buf_ring_add(reactor->recv_buffer_ring,
+                              reactor->recv_buffers + i * config->recv_buffer_size, config->recv_buffer_size,
+                              i, mask, i);
+    }
+    io_uring_buf_ring_advance(reactor->recv_buffer_ring, config->recv_buffer_count);
+
+    // the queues to and from the game tick
+    CHECK_AND_RETHROW(init_spsc_queue(&reactor->game_packets, config->game_queue_size, sizeof(server_packet_t)));
+    CHECK_AND_RETHROW(init_spsc_queue(&reactor->game_sends, config->game_queue_size, sizeof(game_send_t)));
+    reactor->wake_fd = eventfd(0, EFD_CLOEXEC);
+    CHECK_ERRNO(reactor->wake_fd >= 0);
+
+    // the client slab, a client takes the slot of its socket in the file table
+    reactor->clients = calloc(connections, sizeof(client_t));
+    CHECK_ERRNO(reactor->clients != NULL);
+    reactor->client_capacity = connections;
+
+    // preallocate the requests, with room for the accepts, the timer and the wake
+    int request_count = connections * REQUESTS_PER_CONNECTION + ACCEPTS_IN_FLIGHT + 2;
+    reactor->requests = calloc(request_count, sizeof(request_t));
+    CHECK_ERRNO(reactor->requests != NULL);
+    for (int i = request_count - 1; i >= 0; i--) {
+        reactor->requests[i].next_free = reactor->free_requests;
+        reactor->free_requests = &reactor->requests[i];
+    }
 
 cleanup:
     if (IS_ERROR(err)) {
-        SAFE_CLOSE(m_server_socket);
+        SAFE_CLOSE(reactor->server_socket);
     }
     return err;
 }
 
-static request_t* get_request() {
-    request_t* req = NULL;
+err_t init_server(server_config_t* config) {
+    err_t err = NO_ERROR;
 
-    spin_lock_enter(&m_request_lock);
-    if (arrlen(m_requests_pool) == 0) {
-        req = calloc(1, sizeof(request_t));
-    } else {
-        req = arrpop(m_requests_pool);
+    if (config == NULL) {
+        config = &m_default_config;
+    }
+
+    // set the config
+    g_server_config = *config;
+
+    // the buffer ring must be a power of two
+    CHECK(config->recv_buffer_count > 0 && config->recv_buffer_count <= 32768 &&
+          (config->recv_buffer_count & (config->recv_buffer_count - 1)) == 0,
+          "recv buffer count must be a power of two (got %d)", config->recv_buffer_count);
+
+    // the protocol limits packets to 3 byte lengths
+    CHECK(config->max_recv_packet_size <= 2097151, "max recv packet size is over the protocol limit (got %zu)", config->max_recv_packet_size);
+
+    // default to one reactor per core, in low latency mode every reactor needs
+    // a second core for its poll thread so only half of them run reactors
+    if (g_server_config.reactor_count == 0) {
+        int cpus = online_cpus();
+        if (g_server_config.low_latency) {
+            g_server_config.reactor_count = cpus / 2 > 0 ? cpus / 2 : 1;
+        } else {
+            g_server_config.reactor_count = cpus;
+        }
+    }
+
+    // a poll thread spinning on the core of a reactor takes the whole core from it
+    if (g_server_config.low_latency) {
+        for (int i = 0; i < g_server_config.reactor_count; i++) {
+            int cpu = sqpoll_thread_cpu(&g_server_config, i);
+            for (int j = 0; j < g_server_config.reactor_count; j++) {
+                CHECK(cpu != reactor_cpu(j),
+                      "The poll thread of reactor #%d would share cpu %d with reactor #%d, "
+                      "low latency mode needs a spare cpu for every reactor (%d reactors on %d cpus)",
+                      i, cpu, j, g_server_config.reactor_count, online_cpus());
+            }
+        }
+    }
+
+    // reserve the buffer classes and allocate the send buffers that the reactors register
+    CHECK_AND_RETHROW(init_buffer_pool());
+
+    // setup the connection limits
+    CHECK_AND_RETHROW(init_admission());
+
+    // start the workers that compress the large packets
+    CHECK_AND_RETHROW(init_compression_workers(g_server_config.compression_workers));
+    CHECK_AND_RETHROW(init_compression_control());
+
+    // create all the reactors
+    m_reactors = calloc(g_server_config.reactor_count, sizeof(reactor_t));
+    CHECK_ERRNO(m_reactors != NULL);
+    for (int i = 0; i < g_server_config.reactor_count; i++) {
+        m_reactors[i].id = i;
+        m_reactors[i].server_socket = -1;
+        CHECK_AND_RETHROW(init_reactor(&m_reactors[i], &g_server_config));
+    }
+
+    TRACE("Initialized %d reactors", g_server_config.reactor_count);
+
+cleanup:
+    return err;
+}
+
+/**
+ * Take a request from the pool of the reactor, must be called from the reactor thread
+ *
+ * @param reactor   [IN] The reactor
+ *
+ * @return The request, NULL if out of memory
+ */
+static request_t* get_request(reactor_t* reactor) {
+    if (reactor->free_requests == NULL) {
+        // should not happen with a sane config, but a client can have any amount of
+        // packets waiting on compression so we can't refuse. These are never freed
+        request_t* requests = calloc(REQUEST_POOL_GROW, sizeof(request_t));
+        if (requests == NULL) {
+            return NULL;
+        }
+        for (int i = REQUEST_POOL_GROW - 1; i >= 0; i--) {
+            requests[i].next_free = reactor->free_requests;
+            reactor->free_requests = &requests[i];
+        }
+    }
+
+    request_t* request = reactor->free_requests;
+    reactor->free_requests = request->next_free;
+    return request;
+}
+
+/**
+ * Return a request to the pool of the reactor, must be called from the reactor thread
+ *
+ * @param reactor   [IN] The reactor
+ * @param request   [IN] The request, must not be embedded in a client
+ */
+static void put_request(reactor_t* reactor, request_t* request) {
+    request->next_free = reactor->free_requests;
+    reactor->free_requests = request;
+}
+
+/**
+ * The user data for an op of the client, see USER_DATA_CLIENT
+ *
+ * @param client    [IN] The client
+ * @param type      [IN] The type of the op, REQUEST_RECV or REQUEST_SEND
+ */
+static uint64_t client_user_data(client_t* client, request_type_t type) {
+    return USER_DATA_CLIENT |
+           ((uint64_t)type << USER_DATA_TYPE_SHIFT) |
+           ((client->generation & USER_DATA_GENERATION_MASK) << USER_DATA_GENERATION_SHIFT) |
+           (uint32_t)client->socket;
+}
+
+/**
+ * Resolve the user data of a completion to its request
+ *
+ * @param reactor   [IN] The reactor
+ * @param user_data [IN] The user data of the completion
+ *
+ * @return The request, NULL if the completion is for a client that was freed since
+ */
+static request_t* user_data_to_request(reactor_t* reactor, uint64_t user_data) {
+    if (!(user_data & USER_DATA_CLIENT)) {
+        return (request_t*)user_data;
+    }
+
+    uint32_t slot = (uint32_t)user_data;
+    if (slot >= reactor->client_capacity) {
+        return NULL;
+    }
+
+    client_t* client = &reactor->clients[slot];
+    uint64_t generation = (user_data >> USER_DATA_GENERATION_SHIFT) & USER_DATA_GENERATION_MASK;
+    if (!client->in_use || (client->generation & USER_DATA_GENERATION_MASK) != generation) {
+        return NULL;
+    }
+
+    request_type_t type = (user_data & ~USER_DATA_CLIENT) >> USER_DATA_TYPE_SHIFT;
+    return type == REQUEST_RECV ? &client->recv_request : &client->send_request;
+}
+
+/**
+ * Give a recv buffer back to the kernel once we are done with its data
+ *
+ * @param reactor   [IN] The reactor owning the buffer
+ * @param bid       [IN] The buffer id we got in the cqe
+ */
+static void return_recv_buffer(reactor_t* reactor, int bid) {
+    io_uring_buf_ring_add(reactor->recv_buffer_ring,
+                          reactor->recv_buffers + bid * g_server_config.recv_buffer_size, g_server_config.recv_buffer_size,
+                          bid, io_uring_buf_ring_mask(g_server_config.recv_buffer_count), 0);
+    io_uring_buf_ring_advance(reactor->recv_buffer_ring, 1);
+}
+
+static err_t add_accept(reactor_t* reactor) {
+    err_t err = NO_ERROR;
+
+    // while the file table is full the new connections wait in the
+    // backlog of the listening socket
+    while (reactor->accepts_in_flight < ACCEPTS_IN_FLIGHT && arrlen(reactor->free_file_slots) != 0) {
+        // setup the request
+        request_t* request = get_request(reactor);
+        CHECK_ERRNO(request != NULL);
+        request->type = REQUEST_ACCEPT;
+        request->accept.address_len = sizeof(request->accept.address);
+
+        // get an sqe
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&reactor->ring);
+        if (sqe == NULL) {
+            put_request(reactor, request);
+            CHECK_FAIL("Failed to get sqe for accept");
+        }
+
+        // accept straight into a free slot of the file table, the kernel
+        // fills in the address of the peer as part of the accept
+        request->accept.slot = arrpop(reactor->free_file_slots);
+        io_uring_prep_accept_direct(sqe, reactor->server_socket, (struct sockaddr*)&request->accept.address,
+                                    &request->accept.address_len, 0, request->accept.slot);
+        io_uring_sqe_set_flags(sqe, 0);
+        sqe->user_data = (uint64_t)request;
+        reactor->accepts_in_flight++;
     }
-    spin_lock_leave(&m_request_lock);
 
-    return req;
+cleanup:
+    return err;
 }
 
-static err_t add_accept() {
+static err_t add_timer(reactor_t* reactor) {
     err_t err = NO_ERROR;
 
     // setup the request
-    request_t* request = get_request();
+    request_t* request = get_request(reactor);
     CHECK_ERRNO(request != NULL);
-    request->type = REQUEST_ACCEPT;
-    request->accept.client_addr_len = sizeof(request->accept.client_addr);
+    request->type = REQUEST_TIMER;
 
     // get an sqe
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&reactor->ring);
     CHECK_ERRNO(sqe != NULL);
 
-    // setup the sqe for the next accept
-    io_uring_prep_accept(sqe, m_server_socket, &request->accept.client_addr, &request->accept.client_addr_len, 0);
-    io_uring_sqe_set_flags(sqe, 0);
+    // a single timeout drives the deadlines of all the clients, it is
+    // armed again every time it fires
+    io_uring_prep_timeout(sqe, &reactor->timer_interval, 0, 0);
     sqe->user_data = (uint64_t)request;
 
 cleanup:
     return err;
 }
 
-static err_t add_recv(client_t* client) {
+static err_t add_wake(reactor_t* reactor) {
     err_t err = NO_ERROR;
 
     // setup the request
-    request_t* request = get_request();
+    request_t* request = get_request(reactor);
     CHECK_ERRNO(request != NULL);
-    request->type = REQUEST_RECV;
-    request->recv.client = client;
+    request->type = REQUEST_WAKE;
 
     // get an sqe
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&reactor->ring);
     CHECK_ERRNO(sqe != NULL);
 
-    // setup the sqe for recv on the client
-    io_uring_prep_recv(sqe, client->socket, client->recv_buffer, g_server_config.recv_buffer_size, 0);
-    io_uring_sqe_set_flags(sqe, 0);
+    // reading the eventfd resets it, so it only completes again
+    // once the game tick wakes us again
+    io_uring_prep_read(sqe, reactor->wake_fd, &reactor->wake_value, sizeof(reactor->wake_value), 0);
     sqe->user_data = (uint64_t)request;
 
 cleanup:
     return err;
 }
 
-static void disconnect_client(client_t* client) {
-    // remove from the active clients
-    list_del(&client->node);
-
-    // log it
-    TRACE("Client disconnect from: %d.%d.%d.%d:%d",
-          client->address.sin_addr.s_addr & 0xFF, (client->address.sin_addr.s_addr >> 8) & 0xFF,
-          (client->address.sin_addr.s_addr >> 16) & 0xFF, (client->address.sin_addr.s_addr >> 24) & 0xFF,
-          ntohs(client->address.sin_port));
-
-    // close the socket
-    buffer_pool_return_tcp_recv(client->recv_buffer);
-    shutdown(client->socket, SHUT_RDWR);
-    client->socket = -1;
+static err_t add_recv(client_t* client) {
+    err_t err = NO_ERROR;
 
-    // TODO: notify that the client has disconnected
+    // setup the request, only a single recv is armed at a time
+    request_t* request = &client->recv_request;
+    request->type = REQUEST_RECV;
+    request->recv.client = client;
+
+    // get an sqe
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&client->reactor->ring);
+    CHECK_ERRNO(sqe != NULL);
+
+    recv_ring_t* ring = &client->receiver_state.ring;
+    if (ring->data != NULL) {
+        // recv right into the free space of the receive ring, it is
+        // contiguous even when it wraps around
+        io_uring_prep_recv(sqe, client->socket, recv_ring_write_ptr(ring), recv_ring_free(ring), 0);
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    } else {
+        // setup a multishot recv on the client, the kernel will select the buffer
+        // from the ring once data arrives and keep the recv armed after it
+        io_uring_prep_recv_multishot(sqe, client->socket, NULL, 0, 0);
+        io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT | IOSQE_FIXED_FILE);
+        sqe->buf_group = RECV_BUFFER_GROUP;
+    }
+    sqe->user_data = client_user_data(client, REQUEST_RECV);
+
+    client->recv_active = true;
+    client->ops_in_flight++;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Start closing the client, this shuts the socket down which terminates the
+ * multishot recv, the client is only freed once the recv is done with it
+ *
+ * @param client    [IN] The client to close
+ */
+static void close_client(client_t* client) {
+    if (client->closing) {
+        return;
+    }
+    client->closing = true;
+
+    // the socket only lives in the file table, so shut it down through
+    // the ring, we don't care about the result of it
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&client->reactor->ring);
+    if (sqe == NULL) {
+        // the submission queue is full, flush it and try again
+        io_uring_submit(&client->reactor->ring);
+        sqe = io_uring_get_sqe(&client->reactor->ring);
+        if (sqe == NULL) {
+            WARN("Failed to shutdown client, no room in the submission queue");
+            return;
+        }
+    }
+    io_uring_prep_shutdown(sqe, client->socket, SHUT_RDWR);
+    io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | IOSQE_CQE_SKIP_SUCCESS);
+    sqe->user_data = 0;
 
-    // we can safely free the client now
-    free(client);
+    // submit right away, the shutdown must resolve the slot before
+    // it can be given to another socket
+    io_uring_submit(&client->reactor->ring);
 }
 
-err_t server_send_packet(client_t* client, uint8_t* buffer, int32_t size) {
+err_t server_enable_compression(client_t* client) {
     err_t err = NO_ERROR;
 
-    // setup the request
-    request_t* request = get_request();
-    CHECK_ERRNO(request != NULL);
-    request->type = REQUEST_SEND;
-    request->send.client = client;
+    if (g_server_config.compression_threshold < 0) {
+        goto cleanup;
+    }
 
-    // TODO: compression support
-    if (client->receiver_state.compression) {
-        CHECK_FAIL("TODO: compression support");
-    } else {
-        // serialize the packet length
-        int length_len = protocol_write_varint(request->send.varint_temp, 5, size);
-        CHECK(length_len > 0);
+    // the packet itself is not compressed, only the ones after it
+    login_packet_compress_t packet = {
+        .threshold = g_server_config.compression_threshold
+    };
+    CHECK_AND_RETHROW(send_login_packet_compress(client, &packet));
+    client->receiver_state.compression = true;
+
+cleanup:
+    return err;
+}
 
-        // set the length base
-        request->send.vecs[0].iov_base = request->send.varint_temp;
-        request->send.vecs[0].iov_len = length_len;
+void server_enable_encryption(client_t* client, const uint8_t secret[16]) {
+    aes_cfb8_init(&client->receiver_state.cipher, secret, secret);
+    client->receiver_state.encryption = true;
+    send_queue_enable_encryption(&client->send_queue, secret);
+}
 
-        // set the buffer base
-        request->send.vecs[1].iov_base = buffer;
-        request->send.vecs[1].iov_len = size;
+void server_disconnect(client_t* client) {
+    close_client(client);
+}
 
-        // we have two vecs
-        request->send.vecs_count = 2;
-    }
+/**
+ * Convert milliseconds to ticks of the timer wheel, rounding up
+ */
+static uint64_t ms_to_ticks(int ms) {
+    return (ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+}
 
-    // get an sqe
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
-    CHECK_ERRNO(sqe != NULL);
+static err_t send_keep_alive(client_t* client, uint64_t id) {
+    err_t err = NO_ERROR;
 
-    // setup the sqe for recv on the client
-    io_uring_prep_writev(sqe, client->socket, request->send.vecs, request->send.vecs_count, 0);
-    io_uring_sqe_set_flags(sqe, 0);
-    sqe->user_data = (uint64_t)request;
+    uint8_t* buffer = buffer_pool_get_protocol_send();
+    CHECK_ERRNO(buffer != NULL);
+    uint8_t* data = buffer + SERVER_SEND_HEADROOM;
+    data[0] = PLAY_KEEP_ALIVE_ID;
+    protocol_write_i64(data + 1, id);
+
+    // the server owns the buffer from here on, even if sending fails
+    uint8_t* packet_buffer = buffer;
+    buffer = NULL;
+    CHECK_AND_RETHROW(server_send_packet(client, packet_buffer, 1 + sizeof(int64_t), SEND_NORMAL, 0));
 
 cleanup:
+    if (IS_ERROR(err) && buffer != NULL) {
+        buffer_pool_return_protocol_send(buffer);
+    }
     return err;
 }
 
-err_t server_start() {
+/**
+ * The deadline of the client passed, check if it timed out and arm
+ * the timer again for the next deadline if it did not
+ */
+static void client_timer_expired(wheel_timer_t* timer) {
     err_t err = NO_ERROR;
+    client_t* client = LIST_ENTRY(timer, client_t, timer);
+    timer_wheel_t* timers = &client->reactor->timers;
+    uint64_t now = timers->current;
 
-    CHECK(m_server_socket != -1);
+    if (client->closing) {
+        goto cleanup;
+    }
 
-    // the server can run now
-    m_running = true;
+    if (client->state != PROTOCOL_PLAY) {
+        // every phase before play has a deadline, counted from the accept
+        int timeout_ms = client->state == PROTOCOL_HANDSHAKING ? g_server_config.handshake_timeout_ms :
+                         client->state == PROTOCOL_STATUS ? g_server_config.status_timeout_ms :
+                         g_server_config.login_timeout_ms;
+        uint64_t deadline = client->accepted_at + ms_to_ticks(timeout_ms);
+        CHECK_ERROR(now < deadline, ERROR_PROTOCOL, "Client took too long to get out of state %d", client->state);
+        timer_wheel_arm(timers, timer, deadline);
+    } else {
+        uint64_t read_deadline = client->last_recv + ms_to_ticks(g_server_config.read_timeout_ms);
+        CHECK_ERROR(now < read_deadline, ERROR_PROTOCOL, "Client timed out");
 
-    // add an accept
-    add_accept();
+        if (now >= client->next_keep_alive) {
+            CHECK_AND_RETHROW(send_keep_alive(client, now));
+            client->next_keep_alive = now + ms_to_ticks(g_server_config.keep_alive_interval_ms);
+        }
 
-    // wait for a max of all events at the same time
-    while (m_running) {
-        // pull an event from the ring
-        io_uring_submit_and_wait(&m_ring, 1);
+        timer_wheel_arm(timers, timer, client->next_keep_alive < read_deadline ? client->next_keep_alive : read_deadline);
+    }
 
-        size_t count = 0;
-        size_t head = 0;
-        struct io_uring_cqe* cqe = NULL;
-        io_uring_for_each_cqe(&m_ring, head, cqe) {
-            count++;
+cleanup:
+    if (IS_ERROR(err)) {
+        // timed out, or we could not even send it a keep alive
+        close_client(client);
+    }
+}
 
-            // get the client
-            request_t* request = (request_t*)cqe->user_data;
-            CHECK(request != NULL);
+void server_enter_play(client_t* client) {
+    client->state = PROTOCOL_PLAY;
+    atomic_fetch_add_explicit(&m_playing_clients, 1, memory_order_relaxed);
+
+    // start the keep alives right away
+    client->last_recv = client->reactor->timers.current;
+    client->next_keep_alive = 0;
+    timer_wheel_arm(&client->reactor->timers, &client->timer, client->reactor->timers.current);
+
+    // playing clients send large packets (books, plugin messages) that span many
+    // recv buffers, so they get a receive ring of their own instead. The multishot
+    // recv is canceled and the ring is armed once it terminates
+    if (client->recv_active && client->receiver_state.ring.data == NULL) {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&client->reactor->ring);
+        if (sqe == NULL) {
+            // the submission queue is full, flush it and try again
+            io_uring_submit(&client->reactor->ring);
+            sqe = io_uring_get_sqe(&client->reactor->ring);
+        }
+        if (sqe == NULL) {
+            WARN("Failed to cancel the recv of client, no room in the submission queue");
+            return;
+        }
+        io_uring_prep_cancel64(sqe, client_user_data(client, REQUEST_RECV), 0);
+        io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+        sqe->user_data = 0;
+        client->switch_to_ring = true;
+
+        // submit right away, the user data of the recv is reused
+        // for the next recv once this one terminates
+        io_uring_submit(&client->reactor->ring);
+    }
+}
 
-            switch (request->type) {
-                case REQUEST_ACCEPT: {
-                    // make sure we got no error
-                    CHECK_ERROR(cqe->res >= 0, -cqe->res, "Got error accepting");
-
-                    // TODO: ipv6 support
-                    struct sockaddr_in* addr = (struct sockaddr_in*)&request->accept.client_addr;
-                    CHECK(addr->sin_family == AF_INET);
-                    TRACE("New connection from: %d.%d.%d.%d:%d",
-                          addr->sin_addr.s_addr & 0xFF, (addr->sin_addr.s_addr >> 8) & 0xFF,
-                          (addr->sin_addr.s_addr >> 16) & 0xFF, (addr->sin_addr.s_addr >> 24) & 0xFF,
-                          ntohs(addr->sin_port));
-
-                    // an accept has finished, get a new client and set it up, accept should
-                    // never give us an error, if it does then error out
-                    client_t* new_client = calloc(1, sizeof(client_t));
-                    new_client->address = *addr;
-                    new_client->socket = cqe->res;
-                    new_client->recv_buffer = buffer_pool_get_tcp_recv();
-                    list_add_tail(&m_clients, &new_client->node);
-
-                    // add pending recv and accept
-                    CHECK_AND_RETHROW(add_recv(new_client));
-                    CHECK_AND_RETHROW(add_accept());
-                } break;
+/**
+ * Close the socket in the file slot through the ring, any op still in flight
+ * holds its own reference to the file. The slot goes back to the free slots
+ * once the close completes
+ *
+ * @param reactor   [IN] The reactor
+ * @param slot      [IN] The file slot
+ */
+static void close_file_slot(reactor_t* reactor, int slot) {
+    request_t* request = get_request(reactor);
+    struct io_uring_sqe* sqe = NULL;
+    if (request != NULL) {
+        sqe = io_uring_get_sqe(&reactor->ring);
+        if (sqe == NULL) {
+            // the submission queue is full, flush it and try again
+            io_uring_submit(&reactor->ring);
+            sqe = io_uring_get_sqe(&reactor->ring);
+        }
+    }
 
-                case REQUEST_RECV: {
-                    client_t* client = request->recv.client;
-                    if (cqe->res <= 0) {
-                        // disconnected
-                        disconnect_client(client);
-                    } else {
-                        // we got data from socket
-                        err = receiver_consume_data(client, request->recv.client->recv_buffer, cqe->res);
-                        if (err == ERROR_PROTOCOL) {
-                            // we got an error at the protocol level, not really
-                            // important, force disconnect the client
-                            disconnect_client(client);
-                        } else {
-                            // make sure we did not get any other error
-                            CHECK_AND_RETHROW(err);
+    if (sqe == NULL) {
+        // no way to do it through the ring, do it right away
+        WARN("Failed to queue closing file slot %d, closing it synchronously", slot);
+        if (request != NULL) {
+            put_request(reactor, request);
+        }
+        int fd = -1;
+        io_uring_register_files_update(&reactor->ring, slot, &fd, 1);
+        arrpush(reactor->free_file_slots, slot);
+        return;
+    }
 
-                            // re-add the recv
-                            add_recv(client);
-                        }
-                    }
-                } break;
+    request->type = REQUEST_CLOSE;
+    request->close.slot = slot;
+    io_uring_prep_close_direct(sqe, slot);
+    sqe->user_data = (uint64_t)request;
+}
 
-                case REQUEST_SEND: {
-                    client_t* client = request->send.client;
-                    if (cqe->res <= 0) {
-                        // disconnected
-                        disconnect_client(client);
-                    } else {
-                        // the send is done, return the data used for actually
-                        // sending the data
-                        buffer_pool_return_protocol_send(request->send.vecs[request->send.vecs_count - 1].iov_base);
-                    }
-                } break;
-            }
+/**
+ * Free the client, must only be called once no op references it
+ *
+ * @param client    [IN] The client to free
+ */
+static void disconnect_client(client_t* client) {
+    if (client->dirty) {
+        list_del(&client->dirty_node);
+    }
+    timer_wheel_cancel(&client->timer);
+    if (client->receiver_state.ring.data != NULL) {
+        free_recv_ring(&client->receiver_state.ring);
+    }
+    if (client->receiver_state.should_return) {
+        // a packet that was only partially received, the slot is
+        // reset when it is reused so nothing else would free it
+        buffer_pool_free(client->receiver_state.packet);
+    }
 
-            // return the request to the pool until the next one is needed
-            spin_lock_enter(&m_request_lock);
-            arrpush(m_requests_pool, request);
-            spin_lock_leave(&m_request_lock);
-        }
-        io_uring_cq_advance(&m_ring, count);
+    // drop anything that is still queued, zero copy sends
+    // hold their own reference to the data
+    stat_add(&client->reactor->stats.queued_bytes, -(ssize_t)client->send_queue.queued_bytes);
+    send_queue_clear(&client->send_queue);
+
+    if (client->state < PROTOCOL_LOGIN) {
+        // it never got past the server list
+        atomic_fetch_sub_explicit(&m_pending_connections, 1, memory_order_relaxed);
+    } else {
+        // log it, server list pings are not interesting enough
+        TRACE("Client disconnect from: %d.%d.%d.%d:%d",
+              client->address.sin_addr.s_addr & 0xFF, (client->address.sin_addr.s_addr >> 8) & 0xFF,
+              (client->address.sin_addr.s_addr >> 16) & 0xFF, (client->address.sin_addr.s_addr >> 24) & 0xFF,
+              ntohs(client->address.sin_port));
+    }
+
+    if (client->state == PROTOCOL_PLAY) {
+        // it is no longer online
+        atomic_fetch_sub_explicit(&m_playing_clients, 1, memory_order_relaxed);
     }
 
+    // TODO: notify that the client has disconnected
+
+    // we can safely free the client now, anything still carrying the old
+    // generation is dropped once it completes. The file slot is only
+    // freed once the socket in it is closed
+    client->in_use = false;
+    client->generation++;
+    close_file_slot(client->reactor, client->socket);
+    client->socket = -1;
+}
+
+/**
+ * Free the client if it is closing and there are no more completions that
+ * are going to reference it
+ *
+ * @param client    [IN] The client
+ */
+static void try_disconnect_client(client_t* client) {
+    if (client->closing && client->ops_in_flight == 0) {
+        disconnect_client(client);
+    }
+}
+
+/**
+ * Send everything that is queued on the client, only a single send is in
+ * flight per client, once it completes the rest is going to be flushed
+ *
+ * @param client    [IN] The client to flush
+ */
+static err_t flush_client(client_t* client) {
+    err_t err = NO_ERROR;
+    reactor_t* reactor = client->reactor;
+
+    if (client->closing || client->send_in_flight) {
+        goto cleanup;
+    }
+
+    // setup the request, the one of the client is still busy if the
+    // previous send was zero copy and its notification did not arrive yet
+    request_t* request = &client->send_request;
+    if (client->send_request_busy) {
+        request = get_request(reactor);
+        CHECK_ERRNO(request != NULL);
+    }
+    request->type = REQUEST_SEND;
+    request->send.client = client;
+
+    // prepare everything for sending
+    send_queue_t* queue = &client->send_queue;
+    request->send.segment_count = send_queue_prepare(queue, request->send.segments);
+    if (request->send.segment_count == 0) {
+        // nothing to send
+        if (!request->embedded) {
+            put_request(reactor, request);
+        }
+        goto cleanup;
+    }
+
+    // get an sqe
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&reactor->ring);
+    CHECK_ERRNO(sqe != NULL);
+
+    // setup the sqe for send on the client, a single segment doesn't need
+    // the whole message, and large sends are done without copying them
+    // into the socket buffers
+    request->send.zero_copy = g_server_config.send_zc_threshold != 0 && queue->in_flight >= g_server_config.send_zc_threshold;
+    if (request->send.zero_copy) {
+        for (int i = 0; i < request->send.segment_count; i++) {
+            request->send.segments[i]->refs++;
+        }
+
+        if (request->send.segment_count == 1) {
+            if (reactor->send_buffers_registered && buffer_pool_is_registered_send(queue->iovs[0].iov_base)) {
+                // the buffer is already pinned, the whole region is fixed buffer 0
+                io_uring_prep_send_zc_fixed(sqe, client->socket, queue->iovs[0].iov_base, queue->iovs[0].iov_len,
+                                            MSG_WAITALL | MSG_NOSIGNAL, 0, 0);
+            } else {
+                io_uring_prep_send_zc(sqe, client->socket, queue->iovs[0].iov_base, queue->iovs[0].iov_len,
+                                      MSG_WAITALL | MSG_NOSIGNAL, 0);
+            }
+        } else {
+            io_uring_prep_sendmsg_zc(sqe, client->socket, &queue->msg, MSG_WAITALL | MSG_NOSIGNAL);
+        }
+    } else {
+        if (request->send.segment_count == 1) {
+            io_uring_prep_send(sqe, client->socket, queue->iovs[0].iov_base, queue->iovs[0].iov_len,
+                               MSG_WAITALL | MSG_NOSIGNAL);
+        } else {
+            io_uring_prep_sendmsg(sqe, client->socket, &queue->msg, MSG_WAITALL | MSG_NOSIGNAL);
+        }
+    }
+    io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    if (request->embedded) {
+        sqe->user_data = client_user_data(client, REQUEST_SEND);
+        client->send_request_busy = true;
+    } else {
+        sqe->user_data = (uint64_t)request;
+    }
+
+    client->send_in_flight = true;
+    client->ops_in_flight++;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Mark the client for flushing at the end of the current batch of completions
+ *
+ * @param client    [IN] The client
+ */
+static void mark_client_dirty(client_t* client) {
+    if (!client->dirty) {
+        client->dirty = true;
+        list_add_tail(&client->reactor->dirty_clients, &client->dirty_node);
+    }
+}
+
+/**
+ * Called after something was pushed to the send queue of the client, this
+ * decides if the client needs to be kicked, flushed now or at the end of
+ * the reactor loop iteration
+ *
+ * @param client        [IN] The client
+ * @param queued_bytes  [IN] The amount of bytes that were queued before the push
+ */
+static err_t client_queued(client_t* client, size_t queued_bytes) {
+    err_t err = NO_ERROR;
+    reactor_t* reactor = client->reactor;
+    send_queue_t* queue = &client->send_queue;
+
+    stat_add(&reactor->stats.queued_bytes, queue->queued_bytes - queued_bytes);
+    stat_max(&reactor->stats.peak_client_queued_bytes, queue->queued_bytes);
+
+    if (queue->queued_bytes > g_server_config.send_hard_limit) {
+        // the client stopped reading, we are not going to hold
+        // more memory for it
+        WARN("Kicking client with %zu bytes queued", queue->queued_bytes);
+        stat_add(&reactor->stats.kicked_clients, 1);
+        close_client(client);
+    } else if (queue->queued_bytes - queue->in_flight >= g_server_config.send_high_water) {
+        // we have a lot queued, don't wait for the end of the batch
+        CHECK_AND_RETHROW(flush_client(client));
+    } else {
+        mark_client_dirty(client);
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Queue a framed packet on the client according to its send policy
+ *
+ * @param client        [IN] The client
+ * @param buffer        [IN] The send buffer holding the frame, owned by the queue from now on
+ * @param frame         [IN] The frame
+ * @param frame_size    [IN] The size of the frame
+ * @param policy        [IN] The send policy of the packet
+ * @param merge_key     [IN] The merge key for mergeable packets
+ */
+static err_t queue_frame(client_t* client, uint8_t* buffer, uint8_t* frame, size_t frame_size, send_policy_t policy, uint64_t merge_key) {
+    err_t err = NO_ERROR;
+    send_queue_t* queue = &client->send_queue;
+
+    // queue the frame, it is going to be sent together with everything
+    // else that is queued for the client
+    size_t queued_bytes = queue->queued_bytes;
+    if (policy == SEND_MERGEABLE) {
+        if (send_queue_push_merge(queue, merge_key, buffer, frame, frame_size)) {
+            stat_add(&client->reactor->stats.merged_packets, 1);
+        }
+    } else {
+        send_queue_push(queue, buffer, frame, frame_size);
+    }
+    CHECK_AND_RETHROW(client_queued(client, queued_bytes));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Queue a shared frame on the client
+ *
+ * @param client        [IN] The client
+ * @param shared        [IN] The shared frame, the queue takes its own reference if needed
+ * @param policy        [IN] The send policy of the packet
+ * @param merge_key     [IN] The merge key for mergeable packets
+ */
+static err_t queue_shared(client_t* client, send_shared_t* shared, send_policy_t policy, uint64_t merge_key) {
+    err_t err = NO_ERROR;
+    send_queue_t* queue = &client->send_queue;
+
+    size_t queued_bytes = queue->queued_bytes;
+    if (policy == SEND_MERGEABLE) {
+        bool merged = false;
+        CHECK_ERRNO(send_queue_push_shared_merge(queue, merge_key, shared, &merged));
+        if (merged) {
+            stat_add(&client->reactor->stats.merged_packets, 1);
+        }
+    } else {
+        CHECK_ERRNO(send_queue_push_shared(queue, shared));
+    }
+    CHECK_AND_RETHROW(client_queued(client, queued_bytes));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Queue all the pending sends of the client that are done, in order, stopping at
+ * the first one that is still being compressed
+ *
+ * @param client    [IN] The client
+ */
+static err_t drain_pending_sends(client_t* client) {
+    err_t err = NO_ERROR;
+
+    while (!list_empty(&client->pending_sends)) {
+        request_t* request = LIST_ENTRY(client->pending_sends.next, request_t, compress.node);
+        if (!request->compress.done) {
+            break;
+        }
+        list_del(&request->compress.node);
+
+        compression_job_t* job = &request->compress.job;
+        send_shared_t* shared = request->compress.shared;
+        if (shared != NULL) {
+            if (!client->closing) {
+                err = queue_shared(client, shared, request->compress.policy, request->compress.merge_key);
+            }
+            send_shared_put(shared);
+        } else if (job->buffer == NULL) {
+            // a broadcast that failed to compress, the client was closed
+        } else if (client->closing || IS_ERROR(job->err)) {
+            buffer_pool_return_protocol_send(job->buffer);
+        } else {
+            err = queue_frame(client, job->buffer, job->frame, job->frame_size, request->compress.policy, request->compress.merge_key);
+        }
+        put_request(client->reactor, request);
+        CHECK_AND_RETHROW(err);
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Hand the packet to a compression worker, the packet waits on the pending
+ * sends of the client until it comes back
+ */
+static err_t offload_packet(client_t* client, uint8_t* buffer, int32_t size, send_policy_t policy, uint64_t merge_key) {
+    err_t err = NO_ERROR;
+    reactor_t* reactor = client->reactor;
+
+    request_t* request = get_request(reactor);
+    CHECK_ERRNO(request != NULL);
+    request->type = REQUEST_COMPRESS;
+    request->compress.client = client;
+    request->compress.done = false;
+    request->compress.shared = NULL;
+    request->compress.policy = policy;
+    request->compress.merge_key = merge_key;
+    request->compress.job = (compression_job_t){
+        .buffer = buffer,
+        .size = size,
+    };
+    compression_job_init(&request->compress.job, reactor->ring.ring_fd, (uint64_t)request);
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&reactor->ring);
+    if (sqe == NULL) {
+        // the submission queue is full, flush it and try again
+        io_uring_submit(&reactor->ring);
+        sqe = io_uring_get_sqe(&reactor->ring);
+    }
+    if (sqe == NULL) {
+        put_request(reactor, request);
+        CHECK_FAIL("Failed to get sqe for compression");
+    }
+    compression_worker_submit(sqe, &request->compress.job);
+
+    list_add_tail(&client->pending_sends, &request->compress.node);
+    client->ops_in_flight++;
+
+cleanup:
+    return err;
+}
+
+/**
+ * Complete offloaded work on the reactor, a protocol error from
+ * the completion disconnects the client
+ */
+static err_t complete_work(server_work_t* work) {
+    err_t err = NO_ERROR;
+    client_t* client = work->client;
+
+    err = work->complete(work);
+    if (err == ERROR_PROTOCOL) {
+        close_client(client);
+        err = NO_ERROR;
+    }
+    CHECK_AND_RETHROW(err);
+
+cleanup:
+    return err;
+}
+
+err_t server_offload(worker_pool_t* pool, server_work_t* work) {
+    err_t err = NO_ERROR;
+    client_t* client = work->client;
+    reactor_t* reactor = client->reactor;
+
+    if (pool->count == 0) {
+        // nothing to offload to, just do it now
+        work->job.run(&work->job);
+        CHECK_AND_RETHROW(complete_work(work));
+        goto cleanup;
+    }
+
+    request_t* request = get_request(reactor);
+    CHECK_ERRNO(request != NULL);
+    request->type = REQUEST_WORK;
+    request->work.work = work;
+    work->job.reply_ring_fd = reactor->ring.ring_fd;
+    work->job.reply_data = (uint64_t)request;
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&reactor->ring);
+    if (sqe == NULL) {
+        // the submission queue is full, flush it and try again
+        io_uring_submit(&reactor->ring);
+        sqe = io_uring_get_sqe(&reactor->ring);
+    }
+    if (sqe == NULL) {
+        put_request(reactor, request);
+        CHECK_FAIL("Failed to get sqe for offloading work");
+    }
+    worker_pool_submit(pool, sqe, &work->job);
+    client->ops_in_flight++;
+
+cleanup:
+    return err;
+}
+
+err_t server_send_packet(client_t* client, uint8_t* buffer, int32_t size, send_policy_t policy, uint64_t merge_key) {
+    err_t err = NO_ERROR;
+    reactor_t* reactor = client->reactor;
+    send_queue_t* queue = &client->send_queue;
+
+    // no reason to send anything to a closing client
+    if (client->closing) {
+        buffer_pool_return_protocol_send(buffer);
+        goto cleanup;
+    }
+
+    // the client is falling behind, drop whatever it can live without
+    if (policy == SEND_DROPPABLE && queue->queued_bytes >= g_server_config.send_soft_limit) {
+        buffer_pool_return_protocol_send(buffer);
+        stat_add(&reactor->stats.dropped_packets, 1);
+        goto cleanup;
+    }
+
+    bool compression = client->receiver_state.compression;
+    if (compression && size >= g_server_config.compression_offload_threshold && compression_workers_available()) {
+        // large packet, don't stall the reactor on it
+        CHECK_AND_RETHROW(offload_packet(client, buffer, size, policy, merge_key));
+        buffer = NULL;
+        goto cleanup;
+    }
+
+    uint8_t* frame = NULL;
+    size_t frame_size = 0;
+    CHECK_AND_RETHROW(frame_packet(&buffer, size, compression, &frame, &frame_size));
+
+    if (!list_empty(&client->pending_sends)) {
+        // a packet before this one is still being compressed, wait behind it
+        request_t* request = get_request(reactor);
+        CHECK_ERRNO(request != NULL);
+        request->type = REQUEST_COMPRESS;
+        request->compress.client = client;
+        request->compress.done = true;
+        request->compress.shared = NULL;
+        request->compress.policy = policy;
+        request->compress.merge_key = merge_key;
+        request->compress.job = (compression_job_t){
+            .buffer = buffer,
+            .frame = frame,
+            .frame_size = frame_size,
+        };
+        list_add_tail(&client->pending_sends, &request->compress.node);
+        buffer = NULL;
+        goto cleanup;
+    }
+
+    uint8_t* queued_buffer = buffer;
+    buffer = NULL;
+    CHECK_AND_RETHROW(queue_frame(client, queued_buffer, frame, frame_size, policy, merge_key));
+
+cleanup:
+    if (IS_ERROR(err) && buffer != NULL) {
+        buffer_pool_return_protocol_send(buffer);
+    }
+    return err;
+}
+
+err_t server_send_frame(client_t* client, const uint8_t* frame, size_t size) {
+    err_t err = NO_ERROR;
+    send_queue_t* queue = &client->send_queue;
+
+    // no reason to send anything to a closing client
+    if (client->closing) {
+        goto cleanup;
+    }
+
+    CHECK(size <= g_server_config.max_send_packet_size - SERVER_SEND_HEADROOM);
+
+    if (!list_empty(&client->pending_sends)) {
+        // a packet before this one is still being compressed, wait behind it
+        // with a copy of the frame since the caller keeps reusing it
+        uint8_t* buffer = buffer_pool_get_protocol_send();
+        CHECK_ERRNO(buffer != NULL);
+        memcpy(buffer + SERVER_SEND_HEADROOM, frame, size);
+
+        request_t* request = get_request(client->reactor);
+        if (request == NULL) {
+            buffer_pool_return_protocol_send(buffer);
+            CHECK_FAIL("Failed to get request for queueing frame");
+        }
+        request->type = REQUEST_COMPRESS;
+        request->compress.client = client;
+        request->compress.done = true;
+        request->compress.shared = NULL;
+        request->compress.policy = SEND_NORMAL;
+        request->compress.merge_key = 0;
+        request->compress.job = (compression_job_t){
+            .buffer = buffer,
+            .frame = buffer + SERVER_SEND_HEADROOM,
+            .frame_size = size,
+        };
+        list_add_tail(&client->pending_sends, &request->compress.node);
+        goto cleanup;
+    }
+
+    size_t queued_bytes = queue->queued_bytes;
+    CHECK_ERRNO(send_queue_push_copy(queue, frame, size));
+    CHECK_AND_RETHROW(client_queued(client, queued_bytes));
+
+cleanup:
+    return err;
+}
+
+/**
+ * Turn a send buffer holding a framed packet into a shared frame, the
+ * header goes at the start of the headroom before the framing
+ */
+static send_shared_t* make_shared_frame(uint8_t* buffer, bool compressed, uint8_t* frame, size_t frame_size) {
+    send_shared_t* shared = (send_shared_t*)buffer;
+    atomic_init(&shared->refs, 1);
+    shared->compressed = compressed;
+    shared->frame = frame;
+    shared->frame_size = frame_size;
+    return shared;
+}
+
+err_t server_broadcast_create(uint8_t* buffer, int32_t size, server_broadcast_t** broadcast) {
+    err_t err = NO_ERROR;
+    server_broadcast_t* new_broadcast = NULL;
+
+    new_broadcast = calloc(1, sizeof(server_broadcast_t) + g_server_config.reactor_count * sizeof(broadcast_frame_t));
+    CHECK_ERRNO(new_broadcast != NULL);
+    atomic_init(&new_broadcast->refs, 1);
+    for (int i = 0; i < g_server_config.reactor_count; i++) {
+        new_broadcast->compressed[i].waiting = INIT_LIST(&new_broadcast->compressed[i].waiting);
+    }
+
+    // without compression the framing only writes the length into the
+    // headroom, so the packet itself is left as is for the compressed frames
+    uint8_t* frame = NULL;
+    size_t frame_size = 0;
+    CHECK_AND_RETHROW(frame_packet(&buffer, size, false, &frame, &frame_size));
+    new_broadcast->packet = buffer + SERVER_SEND_HEADROOM;
+    new_broadcast->size = size;
+    new_broadcast->frame = make_shared_frame(buffer, false, frame, frame_size);
+    buffer = NULL;
+
+    *broadcast = new_broadcast;
+    new_broadcast = NULL;
+
+cleanup:
+    if (buffer != NULL) {
+        buffer_pool_return_protocol_send(buffer);
+    }
+    free(new_broadcast);
+    return err;
+}
+
+/**
+ * Make the compressed frame of the broadcast for the reactor, large packets are
+ * handed to a compression worker and the clients wait on the frame until it is done
+ *
+ * @param reactor   [IN] The reactor
+ * @param broadcast [IN] The broadcast
+ */
+static err_t compress_broadcast(reactor_t* reactor, server_broadcast_t* broadcast) {
+    err_t err = NO_ERROR;
+    broadcast_frame_t* compressed = &broadcast->compressed[reactor->id];
+
+    // compressing replaces the buffer, so work on a copy of the
+    // packet, the other reactors may still need it
+    uint8_t* buffer = buffer_pool_get_protocol_send();
+    CHECK_ERRNO(buffer != NULL);
+    memcpy(buffer + SERVER_SEND_HEADROOM, broadcast->packet, broadcast->size);
+
+    if (broadcast->size >= g_server_config.compression_offload_threshold && compression_workers_available()) {
+        // large packet, don't stall the reactor on it
+        request_t* request = get_request(reactor);
+        CHECK_ERRNO(request != NULL);
+        request->type = REQUEST_BROADCAST;
+        request->broadcast.broadcast = broadcast;
+        request->broadcast.job = (compression_job_t){
+            .buffer = buffer,
+            .size = broadcast->size,
+        };
+        compression_job_init(&request->broadcast.job, reactor->ring.ring_fd, (uint64_t)request);
+
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&reactor->ring);
+        if (sqe == NULL) {
+            // the submission queue is full, flush it and try again
+            io_uring_submit(&reactor->ring);
+            sqe = io_uring_get_sqe(&reactor->ring);
+        }
+        if (sqe == NULL) {
+            put_request(reactor, request);
+            CHECK_FAIL("Failed to get sqe for compression");
+        }
+        compression_worker_submit(sqe, &request->broadcast.job);
+        buffer = NULL;
+
+        atomic_fetch_add_explicit(&broadcast->refs, 1, memory_order_relaxed);
+        compressed->compressing = true;
+        goto cleanup;
+    }
+
+    uint8_t* frame = NULL;
+    size_t frame_size = 0;
+    CHECK_AND_RETHROW(frame_packet(&buffer, broadcast->size, true, &frame, &frame_size));
+    compressed->shared = make_shared_frame(buffer, true, frame, frame_size);
+    buffer = NULL;
+
+cleanup:
+    if (buffer != NULL) {
+        buffer_pool_return_protocol_send(buffer);
+    }
+    return err;
+}
+
+/**
+ * A worker is done compressing the broadcast for the reactor, hand the frame to all
+ * the clients waiting on it. If it failed the waiting clients are disconnected
+ *
+ * @param reactor   [IN] The reactor
+ * @param request   [IN] The request of the compression
+ */
+static err_t complete_broadcast(reactor_t* reactor, request_t* request) {
+    err_t err = NO_ERROR;
+    server_broadcast_t* broadcast = request->broadcast.broadcast;
+    broadcast_frame_t* compressed = &broadcast->compressed[reactor->id];
+    compression_job_t* job = &request->broadcast.job;
+
+    compressed->compressing = false;
+    if (IS_ERROR(job->err)) {
+        WARN("Failed to compress broadcast, dropping the clients waiting on it");
+        buffer_pool_return_protocol_send(job->buffer);
+    } else {
+        compressed->shared = make_shared_frame(job->buffer, true, job->frame, job->frame_size);
+    }
+
+    while (!list_empty(&compressed->waiting)) {
+        request_t* waiting = LIST_ENTRY(compressed->waiting.next, request_t, compress.wait_node);
+        list_del(&waiting->compress.wait_node);
+
+        client_t* client = waiting->compress.client;
+        if (compressed->shared != NULL) {
+            atomic_fetch_add_explicit(&compressed->shared->refs, 1, memory_order_relaxed);
+            waiting->compress.shared = compressed->shared;
+        } else {
+            close_client(client);
+        }
+        waiting->compress.done = true;
+        client->ops_in_flight--;
+
+        // queue everything that was waiting behind it
+        CHECK_AND_RETHROW(drain_pending_sends(client));
+        try_disconnect_client(client);
+    }
+
+cleanup:
+    server_broadcast_release(broadcast);
+    return err;
+}
+
+err_t server_broadcast_send(client_t* client, server_broadcast_t* broadcast, send_policy_t policy, uint64_t merge_key) {
+    err_t err = NO_ERROR;
+    reactor_t* reactor = client->reactor;
+    send_queue_t* queue = &client->send_queue;
+
+    // the send queue and the pending sends belong to the reactor of the client
+    CHECK(reactor == m_current_reactor, "Broadcast sent to a client of another reactor");
+
+    // no reason to send anything to a closing client
+    if (client->closing) {
+        goto cleanup;
+    }
+
+    // the client is falling behind, drop whatever it can live without
+    if (policy == SEND_DROPPABLE && queue->queued_bytes >= g_server_config.send_soft_limit) {
+        stat_add(&reactor->stats.dropped_packets, 1);
+        goto cleanup;
+    }
+
+    // pick the frame matching the client, the compressed one
+    // is only made once a client of the reactor needs it
+    send_shared_t* shared = broadcast->frame;
+    broadcast_frame_t* compressed = NULL;
+    if (client->receiver_state.compression) {
+        compressed = &broadcast->compressed[reactor->id];
+        if (compressed->shared == NULL && !compressed->compressing) {
+            CHECK_AND_RETHROW(compress_broadcast(reactor, broadcast));
+        }
+        shared = compressed->shared;
+    }
+
+    if (shared == NULL || !list_empty(&client->pending_sends)) {
+        // the frame is still being compressed, or a packet before
+        // this one is, wait behind it
+        request_t* request = get_request(reactor);
+        CHECK_ERRNO(request != NULL);
+        request->type = REQUEST_COMPRESS;
+        request->compress.client = client;
+        request->compress.done = shared != NULL;
+        request->compress.shared = shared;
+        request->compress.policy = policy;
+        request->compress.merge_key = merge_key;
+        request->compress.job = (compression_job_t){ 0 };
+        if (shared != NULL) {
+            atomic_fetch_add_explicit(&shared->refs, 1, memory_order_relaxed);
+        } else {
+            list_add_tail(&compressed->waiting, &request->compress.wait_node);
+            client->ops_in_flight++;
+        }
+        list_add_tail(&client->pending_sends, &request->compress.node);
+        goto cleanup;
+    }
+
+    CHECK_AND_RETHROW(queue_shared(client, shared, policy, merge_key));
+
+cleanup:
+    return err;
+}
+
+void server_broadcast_release(server_broadcast_t* broadcast) {
+    if (atomic_fetch_sub_explicit(&broadcast->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // the clients hold their own references to the frames
+    send_shared_put(broadcast->frame);
+    for (int i = 0; i < g_server_config.reactor_count; i++) {
+        if (broadcast->compressed[i].shared != NULL) {
+            send_shared_put(broadcast->compressed[i].shared);
+        }
+    }
+    free(broadcast);
+}
+
+size_t server_client_queued_bytes(client_t* client) {
+    return client->send_queue.queued_bytes;
+}
+
+client_handle_t server_client_handle(client_t* client) {
+    return (client_handle_t){
+        .reactor = client->reactor->id,
+        .slot = client->socket,
+        .generation = client->generation,
+    };
+}
+
+/**
+ * Resolve a handle on the reactor that owns the client
+ *
+ * @param reactor   [IN] The reactor of the client
+ * @param handle    [IN] The handle
+ *
+ * @return The client, NULL if it was already freed
+ */
+static client_t* resolve_client_handle(reactor_t* reactor, client_handle_t handle) {
+    if (handle.slot >= reactor->client_capacity) {
+        return NULL;
+    }
+
+    client_t* client = &reactor->clients[handle.slot];
+    if (!client->in_use || client->generation != handle.generation) {
+        return NULL;
+    }
+
+    return client;
+}
+
+err_t server_queue_packet(client_t* client, int32_t id, uint8_t* data, int32_t size) {
+    err_t err = NO_ERROR;
+    tick_arena_t* arena = get_tick_arena();
+
+    // the packet is done once it is in the queue, so the arena
+    // is returned only after pushing it
+    server_packet_t packet = {
+        .client = server_client_handle(client),
+        .id = id,
+        .size = size,
+        .data = tick_arena_alloc(arena, size),
+    };
+    CHECK_ERROR(packet.data != NULL, ERROR_PROTOCOL, "The tick arena is full, dropping client");
+    memcpy(packet.data, data, size);
+    CHECK_ERROR(spsc_queue_push(&client->reactor->game_packets, &packet), ERROR_PROTOCOL,
+                "The game tick is falling behind, dropping client");
+
+cleanup:
+    return_tick_arena(arena);
+    return err;
+}
+
+err_t server_drain_packets(err_t (*process)(server_packet_t* packet)) {
+    err_t err = NO_ERROR;
+
+    for (int i = 0; i < g_server_config.reactor_count; i++) {
+        reactor_t* reactor = &m_reactors[i];
+
+        // only take what is already there, so a busy reactor
+        // can't keep the tick here forever
+        size_t count = spsc_queue_count(&reactor->game_packets);
+        for (size_t j = 0; j < count; j++) {
+            server_packet_t packet;
+            spsc_queue_pop(&reactor->game_packets, &packet);
+
+            err = process(&packet);
+            if (err == ERROR_PROTOCOL) {
+                server_queue_disconnect(packet.client);
+                err = NO_ERROR;
+            }
+            CHECK_AND_RETHROW(err);
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * Queue something for the reactor of the client, from the game thread
+ */
+static bool queue_game_send(game_send_t* send) {
+    reactor_t* reactor = &m_reactors[send->client.reactor];
+    if (!spsc_queue_push(&reactor->game_sends, send)) {
+        return false;
+    }
+    reactor->wake_pending = true;
+    return true;
+}
+
+err_t server_queue_send(client_handle_t client, uint8_t* buffer, int32_t size, send_policy_t policy, uint64_t merge_key) {
+    err_t err = NO_ERROR;
+
+    game_send_t send = {
+        .type = GAME_SEND_PACKET,
+        .client = client,
+        .buffer = buffer,
+        .size = size,
+        .policy = policy,
+        .merge_key = merge_key,
+    };
+    if (!queue_game_send(&send)) {
+        buffer_pool_return_protocol_send(buffer);
+        CHECK_FAIL_ERROR(ERROR_PROTOCOL, "The reactor is falling behind, dropping packet");
+    }
+
+cleanup:
+    return err;
+}
+
+err_t server_queue_broadcast(client_handle_t client, server_broadcast_t* broadcast, send_policy_t policy, uint64_t merge_key) {
+    err_t err = NO_ERROR;
+
+    game_send_t send = {
+        .type = GAME_SEND_BROADCAST,
+        .client = client,
+        .broadcast = broadcast,
+        .policy = policy,
+        .merge_key = merge_key,
+    };
+    atomic_fetch_add_explicit(&broadcast->refs, 1, memory_order_relaxed);
+    if (!queue_game_send(&send)) {
+        server_broadcast_release(broadcast);
+        CHECK_FAIL_ERROR(ERROR_PROTOCOL, "The reactor is falling behind, dropping broadcast");
+    }
+
+cleanup:
+    return err;
+}
+
+void server_queue_disconnect(client_handle_t client) {
+    reactor_t* reactor = &m_reactors[client.reactor];
+    game_send_t send = {
+        .type = GAME_SEND_DISCONNECT,
+        .client = client,
+    };
+    if (arrlen(reactor->overflow_disconnects) != 0 || !queue_game_send(&send)) {
+        // the reactor is falling behind, hold on to it until there is room
+        arrpush(reactor->overflow_disconnects, client);
+    }
+}
+
+void server_flush_game_sends() {
+    for (int i = 0; i < g_server_config.reactor_count; i++) {
+        reactor_t* reactor = &m_reactors[i];
+
+        // retry the disconnects that did not fit before
+        while (arrlen(reactor->overflow_disconnects) != 0) {
+            game_send_t send = {
+                .type = GAME_SEND_DISCONNECT,
+                .client = arrlast(reactor->overflow_disconnects),
+            };
+            if (!queue_game_send(&send)) {
+                break;
+            }
+            (void)arrpop(reactor->overflow_disconnects);
+        }
+
+        if (reactor->wake_pending) {
+            reactor->wake_pending = false;
+            eventfd_write(reactor->wake_fd, 1);
+        }
+    }
+}
+
+/**
+ * Do everything the game tick queued for the clients of the reactor
+ *
+ * @param reactor   [IN] The reactor
+ */
+static err_t drain_game_sends(reactor_t* reactor) {
+    err_t err = NO_ERROR;
+
+    game_send_t send;
+    while (spsc_queue_pop(&reactor->game_sends, &send)) {
+        client_t* client = resolve_client_handle(reactor, send.client);
+        switch (send.type) {
+            case GAME_SEND_PACKET: {
+                if (client == NULL) {
+                    // the client left before we got to it
+                    buffer_pool_return_protocol_send(send.buffer);
+                    break;
+                }
+                err = server_send_packet(client, send.buffer, send.size, send.policy, send.merge_key);
+            } break;
+
+            case GAME_SEND_BROADCAST: {
+                if (client != NULL) {
+                    err = server_broadcast_send(client, send.broadcast, send.policy, send.merge_key);
+                }
+                server_broadcast_release(send.broadcast);
+            } break;
+
+            case GAME_SEND_DISCONNECT: {
+                if (client != NULL) {
+                    close_client(client);
+                }
+            } break;
+        }
+
+        if (err == ERROR_PROTOCOL) {
+            close_client(client);
+            err = NO_ERROR;
+        }
+        CHECK_AND_RETHROW(err);
+    }
+
+cleanup:
+    return err;
+}
+
+/**
+ * The event loop of a single reactor
+ *
+ * @param reactor   [IN] The reactor to run
+ */
+static err_t reactor_run(reactor_t* reactor) {
+    err_t err = NO_ERROR;
+
+    CHECK(reactor->server_socket != -1);
+    m_current_reactor = reactor;
+
+    // pin the reactor to its own core
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(reactor_cpu(reactor->id), &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        WARN("Failed to pin reactor #%d to a cpu", reactor->id);
+    }
+
+    // start accepting
+    CHECK_AND_RETHROW(add_accept(reactor));
+
+    // and start ticking the timers
+    CHECK_AND_RETHROW(add_timer(reactor));
+
+    // and listen to the game tick
+    CHECK_AND_RETHROW(add_wake(reactor));
+
+    // wait for a max of all events at the same time
+    while (atomic_load_explicit(&m_running, memory_order_relaxed)) {
+        // pull an event from the ring
+        io_uring_submit_and_wait(&reactor->ring, 1);
+
+        size_t count = 0;
+        size_t head = 0;
+        struct io_uring_cqe* cqe = NULL;
+        io_uring_for_each_cqe(&reactor->ring, head, cqe) {
+            count++;
+
+            // fire and forget ops have no user data
+            if (cqe->user_data == 0) {
+                continue;
+            }
+
+            // get the request, a completion of a client that is already gone
+            // is dropped (after giving back the recv buffer it may hold)
+            request_t* request = user_data_to_request(reactor, cqe->user_data);
+            if (request == NULL) {
+                if (cqe->flags & IORING_CQE_F_BUFFER) {
+                    return_recv_buffer(reactor, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                }
+                continue;
+            }
+
+            switch (request->type) {
+                case REQUEST_ACCEPT: {
+                    int slot = request->accept.slot;
+                    reactor->accepts_in_flight--;
+                    if (cqe->res < 0) {
+                        // failing to accept a single connection should not bring
+                        // the whole reactor down, nothing went into the slot
+                        WARN("Got error accepting: %R", cqe->res);
+                        arrpush(reactor->free_file_slots, slot);
+                    } else if (atomic_load_explicit(&m_pending_connections, memory_order_relaxed) >= g_server_config.max_pending_connections ||
+                               !admission_allow_connection(request->accept.address.sin_addr.s_addr)) {
+                        // over the limits, turn it away before we spend
+                        // anything on it
+                        close_file_slot(reactor, slot);
+                    } else {
+                        // an accept has finished, set up the client in the slot of the
+                        // socket, only the generation carries over from the previous one
+                        // TODO: ipv6 support
+                        client_t* new_client = &reactor->clients[slot];
+                        uint32_t generation = new_client->generation;
+                        memset(new_client, 0, sizeof(*new_client));
+                        new_client->in_use = true;
+                        new_client->generation = generation;
+                        new_client->reactor = reactor;
+                        new_client->address = request->accept.address;
+                        new_client->socket = slot;
+                        new_client->pending_sends = INIT_LIST(&new_client->pending_sends);
+                        new_client->recv_request.embedded = true;
+                        new_client->send_request.embedded = true;
+
+                        // it only has a short while to say what it wants
+                        new_client->accepted_at = reactor->timers.current;
+                        new_client->last_recv = reactor->timers.current;
+                        new_client->timer.callback = client_timer_expired;
+                        timer_wheel_arm(&reactor->timers, &new_client->timer,
+                                        new_client->accepted_at + ms_to_ticks(g_server_config.handshake_timeout_ms));
+                        atomic_fetch_add_explicit(&m_pending_connections, 1, memory_order_relaxed);
+
+                        // add the pending recv
+                        CHECK_AND_RETHROW(add_recv(new_client));
+                    }
+
+                } break;
+
+                case REQUEST_RECV: {
+                    client_t* client = request->recv.client;
+                    if (cqe->res > 0) {
+                        client->last_recv = reactor->timers.current;
+                        protocol_state_t state = client->state;
+                        if (cqe->flags & IORING_CQE_F_BUFFER) {
+                            // we got data from socket, consume it and give the
+                            // buffer back to the kernel right away
+                            int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                            uint8_t* buffer = reactor->recv_buffers + bid * g_server_config.recv_buffer_size;
+                            if (!client->closing) {
+                                err = receiver_consume_data(client, buffer, cqe->res);
+                            }
+                            return_recv_buffer(reactor, bid);
+                        } else if (!client->closing) {
+                            // the data went straight into the receive ring of the client
+                            err = receiver_consume_ring(client, cqe->res);
+                        }
+
+                        if (state < PROTOCOL_LOGIN && client->state >= PROTOCOL_LOGIN) {
+                            // the client is past the server list
+                            atomic_fetch_sub_explicit(&m_pending_connections, 1, memory_order_relaxed);
+                        }
+
+                        if (err == ERROR_PROTOCOL) {
+                            // we got an error at the protocol level, not really
+                            // important, force disconnect the client
+                            close_client(client);
+                            err = NO_ERROR;
+                        } else {
+                            // make sure we did not get any other error
+                            CHECK_AND_RETHROW(err);
+                        }
+                    }
+
+                    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                        // the recv is done with the client
+                        client->recv_active = false;
+                        client->ops_in_flight--;
+
+                        if (!client->closing && client->switch_to_ring) {
+                            // we canceled the multishot to move the client to a receive ring,
+                            // if we can't make one just keep using the shared buffers
+                            client->switch_to_ring = false;
+                            err = receiver_start_ring(client);
+                            if (IS_ERROR(err)) {
+                                WARN("Failed to create a receive ring for client, using recv buffers");
+                                err = NO_ERROR;
+                            }
+                            CHECK_AND_RETHROW(add_recv(client));
+                        } else if (!client->closing && (cqe->res > 0 || cqe->res == -ENOBUFS)) {
+                            // the kernel terminated the multishot (we may have ran out of
+                            // buffers in the ring, they are given back as we finish with
+                            // the completions), or a recv into the receive ring completed,
+                            // arm it again
+                            CHECK_AND_RETHROW(add_recv(client));
+                        } else {
+                            // disconnected, this was the last recv of the client
+                            client->closing = true;
+                            try_disconnect_client(client);
+                        }
+                    }
+                } break;
+
+                case REQUEST_COMPRESS: {
+                    client_t* client = request->compress.client;
+                    compression_job_t* job = &request->compress.job;
+                    if (cqe->res < 0) {
+                        // could not reach the worker, compress it ourselves
+                        job->job.run(&job->job);
+                    }
+                    request->compress.done = true;
+                    client->ops_in_flight--;
+
+                    // queue everything that was waiting on it, the request is
+                    // returned to the pool once it is queued
+                    CHECK_AND_RETHROW(drain_pending_sends(client));
+                    try_disconnect_client(client);
+                } continue;
+
+                case REQUEST_BROADCAST: {
+                    compression_job_t* job = &request->broadcast.job;
+                    if (cqe->res < 0) {
+                        // could not reach the worker, compress it ourselves
+                        job->job.run(&job->job);
+                    }
+                    CHECK_AND_RETHROW(complete_broadcast(reactor, request));
+                } break;
+
+                case REQUEST_WORK: {
+                    server_work_t* work = request->work.work;
+                    client_t* client = work->client;
+                    if (cqe->res < 0) {
+                        // could not reach the worker, do it ourselves
+                        work->job.run(&work->job);
+                    }
+                    client->ops_in_flight--;
+
+                    CHECK_AND_RETHROW(complete_work(work));
+                    try_disconnect_client(client);
+                } break;
+
+                case REQUEST_WAKE: {
+                    // the game tick queued stuff for our clients
+                    CHECK_AND_RETHROW(drain_game_sends(reactor));
+                    CHECK_AND_RETHROW(add_wake(reactor));
+                } break;
+
+                case REQUEST_CLOSE: {
+                    // the socket is gone, the slot can take a new one
+                    if (cqe->res < 0) {
+                        WARN("Failed to close file slot %d: %R", request->close.slot, cqe->res);
+                    }
+                    arrpush(reactor->free_file_slots, request->close.slot);
+                } break;
+
+                case REQUEST_TIMER: {
+                    // run everything that expired since the last time, and
+                    // wait for the next tick
+                    timer_wheel_advance(&reactor->timers, timer_wheel_now());
+                    CHECK_AND_RETHROW(add_timer(reactor));
+                } break;
+
+                case REQUEST_SEND: {
+                    // this is the result of the send, the zero copy notification
+                    // arrives after it and only releases the data
+                    client_t* client = request->send.client;
+                    if (!(cqe->flags & IORING_CQE_F_NOTIF)) {
+                        client->send_in_flight = false;
+
+                        if (cqe->res <= 0) {
+                            // disconnected
+                            close_client(client);
+                        } else {
+                            // drop what was sent, if it was a short send or more was
+                            // queued in the meanwhile flush the rest
+                            send_queue_consume(&client->send_queue, cqe->res);
+                            stat_add(&reactor->stats.queued_bytes, -(ssize_t)cqe->res);
+                            if (client->send_queue.queued_bytes != 0) {
+                                mark_client_dirty(client);
+                            }
+                        }
+                    }
+
+                    // for a zero copy send the kernel owns the data until the notification
+                    // arrives, which is the last completion of it
+                    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                        if (request->send.zero_copy) {
+                            for (int i = 0; i < request->send.segment_count; i++) {
+                                send_segment_put(request->send.segments[i]);
+                            }
+                        }
+
+                        // the send is done with the client
+                        if (request->embedded) {
+                            client->send_request_busy = false;
+                        }
+                        client->ops_in_flight--;
+                        try_disconnect_client(client);
+                    }
+                } break;
+            }
+
+            // return the request to the pool until the next one is needed, multishot
+            // requests stay alive until the kernel terminates them
+            if (!(cqe->flags & IORING_CQE_F_MORE) && !request->embedded) {
+                put_request(reactor, request);
+            }
+        }
+        io_uring_cq_advance(&reactor->ring, count);
+
+        // flush everything that was queued while handling this batch, this
+        // way all the packets of a client go out in a single send
+        while (!list_empty(&reactor->dirty_clients)) {
+            client_t* client = LIST_ENTRY(reactor->dirty_clients.next, client_t, dirty_node);
+            list_del(&client->dirty_node);
+            client->dirty = false;
+            CHECK_AND_RETHROW(flush_client(client));
+        }
+
+        // replace the accepts that completed, this also resumes
+        // accepting once a full file table has a free slot again
+        if (reactor->accepts_in_flight < ACCEPTS_IN_FLIGHT) {
+            CHECK_AND_RETHROW(add_accept(reactor));
+        }
+    }
+
+cleanup:
+    atomic_store_explicit(&m_running, false, memory_order_relaxed);
+    return err;
+}
+
+static int reactor_thread(void* arg) {
+    reactor_t* reactor = arg;
+    err_t err = reactor_run(reactor);
+    if (IS_ERROR(err)) {
+        ERROR("Reactor #%d stopped with error %R", reactor->id, err);
+    }
+    return err;
+}
+
+err_t server_start() {
+    err_t err = NO_ERROR;
+
+    CHECK(m_reactors != NULL);
+
+    // the server can run now
+    atomic_store_explicit(&m_running, true, memory_order_relaxed);
+
+    // start all the reactors except the first one on their own
+    // threads, the first one is going to run on the current thread
+    for (int i = 1; i < g_server_config.reactor_count; i++) {
+        CHECK_ERRNO(thrd_create(&m_reactors[i].thread, reactor_thread, &m_reactors[i]) == thrd_success);
+    }
+
+    TRACE("Started %d reactors", g_server_config.reactor_count);
+
+    CHECK_AND_RETHROW(reactor_run(&m_reactors[0]));
+
 cleanup:
-    m_running = false;
+    atomic_store_explicit(&m_running, false, memory_order_relaxed);
     return err;
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <net/worker_pool.h>
 #include <lib/except.h>
 
 #include <liburing.h>
@@ -12,6 +13,14 @@ typedef struct server_config {
      */
     uint16_t port;
 
+    /**
+     * The amount of network reactors, each reactor has its own thread,
+     * io uring and listening socket (bound with SO_REUSEPORT), and owns
+     * the clients that were accepted on it. 0 means one per core, or
+     * one per two cores in low latency mode (see low_latency)
+     */
+    int reactor_count;
+
     /**
      * The max amount of concurrent player connections, these
      * are for actual players playing the game
@@ -26,6 +35,32 @@ typedef struct server_config {
      */
     uint16_t max_server_list_pending;
 
+    /**
+     * The max amount of connections that are still in the handshaking or
+     * status phase, anything over this is closed right after the accept
+     */
+    int max_pending_connections;
+
+    /**
+     * Token bucket limits for new connections, the rate is in connections
+     * per second and the burst is how many can arrive at once. These are
+     * checked right after the accept, before anything is allocated for the
+     * connection. A rate of 0 means no limit
+     */
+    int connection_rate;
+    int connection_burst;
+    int connection_rate_per_address;
+    int connection_burst_per_address;
+
+    /**
+     * Token bucket limits for status requests, a client going over
+     * these is disconnected instead of getting a response
+     */
+    int status_rate;
+    int status_burst;
+    int status_rate_per_address;
+    int status_burst_per_address;
+
     /**
      * The data size used for the tcp recv, this is much lower than the max recv packet
      * size because tcp packets usually only transmit low amount of data, so no need to use
@@ -33,6 +68,14 @@ typedef struct server_config {
      */
     size_t recv_buffer_size;
 
+    /**
+     * The amount of recv buffers each reactor gives the kernel through its
+     * provided buffer ring, buffers are only taken when data arrives so this
+     * only needs to cover the sockets that are readable at the same time.
+     * Must be a power of two
+     */
+    int recv_buffer_count;
+
     /**
      * This is the max packet size for
      */
@@ -42,8 +85,210 @@ typedef struct server_config {
      * The max size for outgoing packet
      */
     size_t max_send_packet_size;
+
+    /**
+     * Packets with a frame at least this large are sent with a zero copy send,
+     * the kernel then owns the send buffer until it notifies us that it is done
+     * with it. Zero copy only pays off for large sends, 0 disables it
+     */
+    size_t send_zc_threshold;
+
+    /**
+     * The amount of send buffers that are allocated up front and registered
+     * as fixed buffers with every reactor ring, zero copy sends from them don't
+     * need to pin the pages on every send. Once these run out the pool falls
+     * back to normal buffers. 0 disables it
+     */
+    int registered_send_buffers;
+
+    /**
+     * The amount of memory the free buffers of the pool can hold on to, once the
+     * buffers that were not needed for a while go over this they are given back
+     * to the kernel. They are also given back when the system is low on memory
+     */
+    size_t buffer_idle_limit;
+
+    /**
+     * Back the large buffer classes and the registered send buffers with transparent
+     * huge pages, this cuts the TLB misses when going over many large buffers. The
+     * tick arenas are set up before the server, so main passes this to them as well
+     */
+    bool huge_pages;
+
+    /**
+     * The amount of entries in the queues between every reactor and the game tick, one
+     * for the packets of playing clients and one for what the game tick sends back. A
+     * client whose packet does not fit is disconnected. Must be a power of two
+     */
+    int game_queue_size;
+
+    /**
+     * Packets sent to a client are queued and flushed in a single send at the end
+     * of the reactor loop iteration, once this many bytes are waiting the client is
+     * flushed right away instead
+     */
+    size_t send_high_water;
+
+    /**
+     * Once this many bytes are queued for a client, which happens when it stops
+     * reading, droppable packets (particles, sounds) are no longer queued for it
+     */
+    size_t send_soft_limit;
+
+    /**
+     * A client that has more than this queued is kicked, this way a single stalled
+     * client can't make the server hold an unbounded amount of memory
+     */
+    size_t send_hard_limit;
+
+    /**
+     * Packets of at least this size are compressed once the client is told to
+     * enable compression during login, -1 disables compression entirely
+     */
+    int compression_threshold;
+
+    /**
+     * The deflate level to start with, 1 is the fastest and 9 the smallest. The level is
+     * moved between the min and max based on the tick time and how busy the compression
+     * workers are, once at the min level the compression threshold is raised up to the
+     * max threshold instead (never below the threshold the clients were told about)
+     */
+    int compression_level;
+    int compression_level_min;
+    int compression_level_max;
+    int compression_threshold_max;
+
+    /**
+     * The tick time we want to stay under, in milliseconds, compression
+     * gets cheaper as the tick time gets closer to this
+     */
+    double compression_target_mspt;
+
+    /**
+     * The amount of compression worker threads, packets of at least the offload
+     * threshold are compressed on them so the reactors are never stalled by
+     * large packets. With no workers everything is compressed on the reactor
+     */
+    int compression_workers;
+    int compression_offload_threshold;
+
+    /**
+     * The amount of login worker threads, the RSA decrypt of the key
+     * exchange runs on them so a burst of logins never stalls the reactors
+     */
+    int login_workers;
+
+    /**
+     * How long a connection has to finish the handshake, to get the server list
+     * status (the whole lifetime of a status connection) and to log in, all
+     * counted from the accept, in milliseconds
+     */
+    int handshake_timeout_ms;
+    int status_timeout_ms;
+    int login_timeout_ms;
+
+    /**
+     * A playing client that sent nothing for this long is disconnected, in
+     * milliseconds. Keep alives are sent every keep alive interval so a live
+     * client always has something to answer
+     */
+    int read_timeout_ms;
+    int keep_alive_interval_ms;
+
+    /**
+     * Low latency mode, every reactor ring gets a kernel thread polling its
+     * submission queue (so submitting needs no syscall) and the sockets are
+     * busy polled instead of waiting for the interrupt. This costs a core per
+     * reactor for the poll thread, so only use it when latency matters. The
+     * server refuses to start if a poll thread would land on a reactor core
+     */
+    bool low_latency;
+
+    /**
+     * The first cpu for the submission queue poll threads, the poll thread of
+     * reactor N is pinned to this + N. -1 puts them right after the reactors
+     */
+    int sqpoll_cpu;
+
+    /**
+     * How long the poll thread keeps spinning without any submission before
+     * it goes to sleep, in milliseconds
+     */
+    unsigned sqpoll_idle_ms;
+
+    /**
+     * How long to busy poll a socket for new data, in microseconds
+     */
+    unsigned busy_poll_usec;
 } server_config_t;
 
+typedef struct server_stats {
+    /**
+     * The amount of bytes queued over all the clients
+     */
+    size_t queued_bytes;
+
+    /**
+     * The most bytes that were queued for a single client
+     */
+    size_t peak_client_queued_bytes;
+
+    /**
+     * Packets that were dropped because the client was over the soft limit
+     */
+    size_t dropped_packets;
+
+    /**
+     * Packets that replaced a previous packet that was not sent yet
+     */
+    size_t merged_packets;
+
+    /**
+     * Clients that were kicked for going over the hard limit
+     */
+    size_t kicked_clients;
+} server_stats_t;
+
+/**
+ * Work that a client needs done off the reactor, the job runs on a worker
+ * and once it is done the completion runs on the reactor of the client
+ */
+typedef struct server_work {
+    // the job of the pool, must be first
+    worker_job_t job;
+
+    // the client the work is for, it is not freed until the work is done
+    client_t* client;
+
+    // called on the reactor once the job is done, always called (even if the
+    // client is closing by then) and owns the work from then on. Returning
+    // ERROR_PROTOCOL disconnects the client
+    err_t (*complete)(struct server_work* work);
+} server_work_t;
+
+/**
+ * A packet of a playing client, queued by the reactor for the game tick. Only the
+ * packet id is parsed, the data is copied into the tick arena so it stays valid
+ * until the end of the tick it is processed in
+ */
+typedef struct server_packet {
+    // the client that sent it
+    client_handle_t client;
+
+    // the id of the packet, and the data after it
+    int32_t id;
+    int32_t size;
+    uint8_t* data;
+} server_packet_t;
+
+/**
+ * The amount of bytes reserved at the start of every send buffer, the
+ * packet itself is written right after it so the framing can be written
+ * in place before it and the whole frame is contiguous. The send queue
+ * keeps its segment header at the start of it
+ */
+#define SERVER_SEND_HEADROOM 64
+
 /**
  * The current server config
  */
@@ -57,18 +302,216 @@ extern server_config_t g_server_config;
 err_t init_server(server_config_t* config);
 
 /**
- * Start the server on the current thread
+ * Start the server, the first reactor runs on the current thread
+ * and the rest get a thread of their own
  */
 err_t server_start();
 
+/**
+ * Get the default server config, to be tweaked and passed to init_server
+ *
+ * @param config    [OUT] The default config
+ */
+void server_get_default_config(server_config_t* config);
+
+/**
+ * Get the network stats summed over all the reactors
+ *
+ * @param stats     [OUT] The stats
+ */
+void server_get_stats(server_stats_t* stats);
+
+/**
+ * The amount of clients in the play state over all the reactors, can be
+ * called from any thread
+ */
+int server_playing_clients();
+
+/**
+ * Enable compression for the client, this sends the set compression packet
+ * and every packet after it is compressed. Does nothing if compression is
+ * disabled in the config
+ *
+ * @param client    [IN] The client, must be in the login phase
+ */
+err_t server_enable_compression(client_t* client);
+
+/**
+ * Enable encryption for the client, everything sent from now on and
+ * everything received after the current packet is encrypted
+ *
+ * @param client    [IN] The client
+ * @param secret    [IN] The shared secret, used both as the key and the iv
+ */
+void server_enable_encryption(client_t* client, const uint8_t secret[16]);
+
+/**
+ * Move the client to the play state, this starts sending it keep alives
+ *
+ * @param client    [IN] The client, must be done with the login
+ */
+void server_enter_play(client_t* client);
+
+/**
+ * Close the connection of the client, anything that is still
+ * queued for it is dropped
+ *
+ * @param client    [IN] The client to disconnect
+ */
+void server_disconnect(client_t* client);
+
+/**
+ * Run the job of the work on one of the workers of the pool, and the completion
+ * back on the reactor of the client. If the pool has no workers both run right away
+ *
+ * @param pool      [IN] The pool to run the job on
+ * @param work      [IN] The work, the client must be set
+ */
+err_t server_offload(worker_pool_t* pool, server_work_t* work);
+
 /**
  * This sends a minecraft packet, the buffer should contain the packet id
- * and the payload but not the length.
+ * and the payload but not the length, starting at SERVER_SEND_HEADROOM.
+ *
+ * The packet is queued on the client and flushed with the rest of the
+ * packets of the client, the send buffer is owned by the server from now on,
+ * even if sending fails.
  *
  * This function will also handle compression if needed.
  *
  * @param client    [IN] The client to send to
- * @param buffer    [IN] The buffer to send
- * @param size      [IN] The size of the buffer to send
+ * @param buffer    [IN] The send buffer, taken from buffer_pool_get_protocol_send
+ * @param size      [IN] The size of the packet in the buffer (not including the headroom)
+ * @param policy    [IN] What to do with the packet when the client falls behind
+ * @param merge_key [IN] The merge key for SEND_MERGEABLE packets
+ */
+err_t server_send_packet(client_t* client, uint8_t* buffer, int32_t size, send_policy_t policy, uint64_t merge_key);
+
+/**
+ * This sends an already framed minecraft packet (including its length), the
+ * data is copied so the caller can keep reusing it. This is meant for packets
+ * that are encoded once and sent many times, so it does not handle compression.
+ * The frame still goes out after any packet that is being compressed
+ *
+ * @param client    [IN] The client to send to
+ * @param frame     [IN] The framed packet
+ * @param size      [IN] The size of the framed packet
+ */
+err_t server_send_frame(client_t* client, const uint8_t* frame, size_t size);
+
+/**
+ * A packet that is encoded once and sent to many clients, on any reactor
+ */
+typedef struct server_broadcast server_broadcast_t;
+
+/**
+ * Create a broadcast of a packet for sending it to many clients, the buffer is set up the
+ * same as for server_send_packet. The packet is framed right away for the clients without
+ * compression, and compressed once per reactor the first time one of its clients with
+ * compression needs it (by a worker if it is large enough to be offloaded).
+ *
+ * Can be called from any thread, the send buffer is owned by the server from now on even if this fails
+ *
+ * @param buffer    [IN]    The send buffer, taken from buffer_pool_get_protocol_send
+ * @param size      [IN]    The size of the packet in the buffer (not including the headroom)
+ * @param broadcast [OUT]   The broadcast, release it once done sending it
+ */
+err_t server_broadcast_create(uint8_t* buffer, int32_t size, server_broadcast_t** broadcast);
+
+/**
+ * Send the broadcast to a client, the client references the frame instead of copying
+ * it whenever it can. Must be called on the reactor of the client, the game tick uses
+ * server_queue_broadcast instead
+ *
+ * @param client    [IN] The client to send to
+ * @param broadcast [IN] The broadcast
+ * @param policy    [IN] What to do with the packet when the client falls behind
+ * @param merge_key [IN] The merge key for SEND_MERGEABLE packets
+ */
+err_t server_broadcast_send(client_t* client, server_broadcast_t* broadcast, send_policy_t policy, uint64_t merge_key);
+
+/**
+ * Release the broadcast, it is freed once every client is done sending
+ * it. Can be called from any thread
+ *
+ * @param broadcast [IN] The broadcast
+ */
+void server_broadcast_release(server_broadcast_t* broadcast);
+
+/**
+ * The amount of bytes queued for the client that were not sent yet, only
+ * called on the reactor of the client. This is what the send policies and
+ * the limits in the config are checked against
+ *
+ * @param client    [IN] The client
+ */
+size_t server_client_queued_bytes(client_t* client);
+
+/**
+ * Get a handle to the client, to be used outside of the reactor
+ *
+ * @param client    [IN] The client
+ */
+client_handle_t server_client_handle(client_t* client);
+
+/**
+ * Queue a packet of a playing client for the game tick, called on
+ * the reactor of the client
+ *
+ * @param client    [IN] The client that sent the packet
+ * @param id        [IN] The id of the packet
+ * @param data      [IN] The data of the packet after the id, it is copied
+ * @param size      [IN] The size of the data
+ */
+err_t server_queue_packet(client_t* client, int32_t id, uint8_t* data, int32_t size);
+
+/**
+ * Process the packets that the reactors queued for the game tick, only called from
+ * the game thread. Only the packets that were queued when this is called are processed.
+ * A protocol error from processing a packet disconnects its client
+ *
+ * @param process   [IN] Called for every packet
+ */
+err_t server_drain_packets(err_t (*process)(server_packet_t* packet));
+
+/**
+ * Send a packet from the game tick, it is handed to the reactor of the client which
+ * sends it like server_send_packet (or drops it if the client is gone by then). Only
+ * called from the game thread, the reactors get it once server_flush_game_sends is called
+ *
+ * The send buffer is owned by the server from now on, even if sending fails
+ *
+ * @param client    [IN] The client to send to
+ * @param buffer    [IN] The send buffer, taken from buffer_pool_get_protocol_send
+ * @param size      [IN] The size of the packet in the buffer (not including the headroom)
+ * @param policy    [IN] What to do with the packet when the client falls behind
+ * @param merge_key [IN] The merge key for SEND_MERGEABLE packets
+ */
+err_t server_queue_send(client_handle_t client, uint8_t* buffer, int32_t size, send_policy_t policy, uint64_t merge_key);
+
+/**
+ * Send a broadcast from the game tick, the reactor of the client sends it like
+ * server_broadcast_send. The queue holds its own reference to the broadcast, so
+ * it can be released right after queueing it to all the clients
+ *
+ * @param client    [IN] The client to send to
+ * @param broadcast [IN] The broadcast
+ * @param policy    [IN] What to do with the packet when the client falls behind
+ * @param merge_key [IN] The merge key for SEND_MERGEABLE packets
+ */
+err_t server_queue_broadcast(client_handle_t client, server_broadcast_t* broadcast, send_policy_t policy, uint64_t merge_key);
+
+/**
+ * Disconnect the client from the game tick, only called from the game thread. If
+ * the reactor is falling behind the disconnect is held and queued again on the
+ * next flush, so it is never lost
+ *
+ * @param client    [IN] The client to disconnect
+ */
+void server_queue_disconnect(client_handle_t client);
+
+/**
+ * Wake the reactors that got anything from the game tick since the last
+ * flush, done once at the end of every game tick
  */
-err_t server_send_packet(client_t* client, uint8_t* buffer, int32_t size);
+void server_flush_game_sends();
@@ -0,0 +1,115 @@
+#include "timer_wheel.h"
+
+#include <time.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void init_timer_wheel(timer_wheel_t* wheel, uint64_t now) {
+    wheel->current = now;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            wheel->slots[level][slot] = INIT_LIST(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+uint64_t timer_wheel_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000ull + ts.tv_nsec / 1000000) / TIMER_WHEEL_TICK_MS;
+}
+
+/**
+ * Put the timer in the slot it belongs to, the closer it is
+ * to expiring the lower the level
+ */
+static void add_timer(timer_wheel_t* wheel, wheel_timer_t* timer) {
+    uint64_t expires = timer->expires;
+    list_t* slot = NULL;
+
+    if ((int64_t)(expires - wheel->current) < 0) {
+        // already expired, run it on the next tick
+        slot = &wheel->slots[0][wheel->current & SLOT_MASK];
+    } else {
+        uint64_t delta = expires - wheel->current;
+        int level = 0;
+        while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ull << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+            level++;
+        }
+
+        // too far into the future for the wheel, it is
+        // going to be moved down again once we get there
+        if (delta >= (1ull << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))) {
+            expires = wheel->current + (1ull << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1;
+        }
+
+        slot = &wheel->slots[level][(expires >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+    }
+
+    list_add_tail(slot, &timer->node);
+}
+
+void timer_wheel_arm(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t expires) {
+    if (timer->armed) {
+        list_del(&timer->node);
+    }
+    timer->expires = expires;
+    timer->armed = true;
+    add_timer(wheel, timer);
+}
+
+void timer_wheel_cancel(wheel_timer_t* timer) {
+    if (timer->armed) {
+        list_del(&timer->node);
+        timer->armed = false;
+    }
+}
+
+/**
+ * Move all the timers of a slot down to the lower levels
+ *
+ * @return The index of the slot, once it is 0 the level above needs to be cascaded as well
+ */
+static int cascade(timer_wheel_t* wheel, int level) {
+    int index = (wheel->current >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+    list_t* slot = &wheel->slots[level][index];
+
+    while (!list_empty(slot)) {
+        wheel_timer_t* timer = LIST_ENTRY(slot->next, wheel_timer_t, node);
+        list_del(&timer->node);
+        add_timer(wheel, timer);
+    }
+
+    return index;
+}
+
+void timer_wheel_advance(timer_wheel_t* wheel, uint64_t now) {
+    while ((int64_t)(now - wheel->current) >= 0) {
+        // every time the lower level wraps around pull the
+        // next slot of the level above it down
+        int index = wheel->current & SLOT_MASK;
+        for (int level = 1; index == 0 && level < TIMER_WHEEL_LEVELS; level++) {
+            index = cascade(wheel, level);
+        }
+
+        // take the expired timers out of the wheel before running any of
+        // them, so a timer that arms itself again lands in a later tick
+        list_t expired = INIT_LIST(&expired);
+        list_t* slot = &wheel->slots[0][wheel->current & SLOT_MASK];
+        if (!list_empty(slot)) {
+            expired.next = slot->next;
+            expired.prev = slot->prev;
+            expired.next->prev = &expired;
+            expired.prev->next = &expired;
+            *slot = INIT_LIST(slot);
+        }
+        wheel->current++;
+
+        while (!list_empty(&expired)) {
+            wheel_timer_t* timer = LIST_ENTRY(expired.next, wheel_timer_t, node);
+            list_del(&timer->node);
+            timer->armed = false;
+            timer->callback(timer);
+        }
+    }
+}
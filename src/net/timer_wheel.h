@@ -0,0 +1,84 @@
+#pragma once
+
+#include <lib/list.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The wheel has a level per 64 ticks, at a tick of 100ms the last
+ * level covers more than 19 days which is more than we ever need
+ */
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+/**
+ * The length of a single tick, in milliseconds
+ */
+#define TIMER_WHEEL_TICK_MS 100
+
+typedef struct wheel_timer {
+    // the node in the slot of the timer
+    list_node_t node;
+
+    // the tick the timer expires at
+    uint64_t expires;
+
+    // called when the timer expires, the timer is no
+    // longer armed by then so it can arm itself again
+    void (*callback)(struct wheel_timer* timer);
+
+    // is the timer in the wheel
+    bool armed;
+} wheel_timer_t;
+
+/**
+ * A hierarchical timing wheel, arming and canceling a timer is O(1) no
+ * matter how many timers there are. Timers far in the future sit on the
+ * higher levels and are moved down as the wheel gets closer to them
+ */
+typedef struct timer_wheel {
+    // the next tick that is going to be processed
+    uint64_t current;
+
+    // the slots of every level
+    list_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/**
+ * Setup the wheel, starting from the given tick
+ *
+ * @param wheel     [IN] The wheel
+ * @param now       [IN] The current tick
+ */
+void init_timer_wheel(timer_wheel_t* wheel, uint64_t now);
+
+/**
+ * The current tick of the monotonic clock
+ */
+uint64_t timer_wheel_now();
+
+/**
+ * Arm the timer, if it is already armed it is moved
+ *
+ * @param wheel     [IN] The wheel
+ * @param timer     [IN] The timer, the callback must be set
+ * @param expires   [IN] The tick to expire at, a tick that already passed expires on the next advance
+ */
+void timer_wheel_arm(timer_wheel_t* wheel, wheel_timer_t* timer, uint64_t expires);
+
+/**
+ * Cancel the timer, does nothing if it is not armed
+ *
+ * @param timer     [IN] The timer
+ */
+void timer_wheel_cancel(wheel_timer_t* timer);
+
+/**
+ * Run all the timers that expired up to the given tick
+ *
+ * @param wheel     [IN] The wheel
+ * @param now       [IN] The current tick
+ */
+void timer_wheel_advance(timer_wheel_t* wheel, uint64_t now);
@@ -0,0 +1,112 @@
+#include "worker_pool.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * The size of the worker rings, this bounds the amount of
+ * replies a worker can have in flight at once
+ */
+#define WORKER_RING_SIZE 256
+
+/**
+ * A reply that failed to post comes back to the worker with this bit
+ * set in its user data, jobs are aligned so the bit is always free
+ */
+#define REPLY_FAILED_TAG 1
+
+static uint64_t get_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Post the completion of the job back to its reactor
+ */
+static void post_reply(worker_t* worker, worker_job_t* job) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&worker->ring);
+    while (sqe == NULL) {
+        // the queue is full, push it to the kernel
+        io_uring_submit(&worker->ring);
+        sqe = io_uring_get_sqe(&worker->ring);
+    }
+    io_uring_prep_msg_ring(sqe, job->reply_ring_fd, 0, job->reply_data, 0);
+    io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+    io_uring_sqe_set_data64(sqe, (uint64_t)job | REPLY_FAILED_TAG);
+}
+
+static int worker_thread(void* arg) {
+    worker_t* worker = arg;
+
+    while (true) {
+        io_uring_submit_and_wait(&worker->ring, 1);
+
+        size_t count = 0;
+        size_t head = 0;
+        struct io_uring_cqe* cqe = NULL;
+        io_uring_for_each_cqe(&worker->ring, head, cqe) {
+            count++;
+
+            if (cqe->user_data & REPLY_FAILED_TAG) {
+                // the reply did not make it (the completion queue of the
+                // reactor may be full), just try again
+                worker_job_t* job = (worker_job_t*)(cqe->user_data & ~REPLY_FAILED_TAG);
+                post_reply(worker, job);
+                continue;
+            }
+
+            worker_job_t* job = (worker_job_t*)cqe->user_data;
+            uint64_t start = get_time_ns();
+            job->run(job);
+            uint64_t busy_ns = atomic_load_explicit(&worker->busy_ns, memory_order_relaxed) + get_time_ns() - start;
+            atomic_store_explicit(&worker->busy_ns, busy_ns, memory_order_relaxed);
+            post_reply(worker, job);
+        }
+        io_uring_cq_advance(&worker->ring, count);
+    }
+
+    return 0;
+}
+
+err_t init_worker_pool(worker_pool_t* pool, const char* name, int count) {
+    err_t err = NO_ERROR;
+
+    pool->name = name;
+    if (count == 0) {
+        goto cleanup;
+    }
+
+    pool->workers = calloc(count, sizeof(worker_t));
+    CHECK_ERRNO(pool->workers != NULL);
+
+    for (int i = 0; i < count; i++) {
+        worker_t* worker = &pool->workers[i];
+        int ret = io_uring_queue_init(WORKER_RING_SIZE, &worker->ring, 0);
+        CHECK_ERROR(ret == 0, ret, "Failed to setup the ring of %s worker #%d", name, i);
+        CHECK_ERRNO(thrd_create(&worker->thread, worker_thread, worker) == thrd_success);
+        pool->count++;
+    }
+
+    TRACE("Started %d %s workers", count, name);
+
+cleanup:
+    return err;
+}
+
+uint64_t worker_pool_busy_ns(worker_pool_t* pool) {
+    uint64_t busy_ns = 0;
+    for (int i = 0; i < pool->count; i++) {
+        busy_ns += atomic_load_explicit(&pool->workers[i].busy_ns, memory_order_relaxed);
+    }
+    return busy_ns;
+}
+
+void worker_pool_submit(worker_pool_t* pool, struct io_uring_sqe* sqe, worker_job_t* job) {
+    unsigned index = atomic_fetch_add_explicit(&pool->next_worker, 1, memory_order_relaxed) % pool->count;
+    worker_t* worker = &pool->workers[index];
+
+    io_uring_prep_msg_ring(sqe, worker->ring.ring_fd, 0, (uint64_t)job, 0);
+    io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+    io_uring_sqe_set_data64(sqe, job->reply_data);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <lib/except.h>
+
+#include <liburing.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * A pool of threads for work that is too heavy to do on a reactor (compressing large
+ * packets, RSA decrypts), without any locks or queues between them.
+ *
+ * Jobs go from the reactor to a worker and back as io_uring messages
+ * (IORING_OP_MSG_RING), so a worker simply waits on its own ring and the
+ * reactor gets the result as a normal completion.
+ */
+typedef struct worker_job {
+    // the work to do, runs on the worker thread
+    void (*run)(struct worker_job* job);
+
+    // where to post the completion once the job is done
+    int reply_ring_fd;
+    uint64_t reply_data;
+} worker_job_t;
+
+typedef struct worker {
+    // the ring of the worker, jobs arrive on it as completions
+    struct io_uring ring;
+
+    // the thread of the worker
+    thrd_t thread;
+
+    // the time the worker spent running jobs, only the worker writes it
+    atomic_uint_fast64_t busy_ns;
+} worker_t;
+
+typedef struct worker_pool {
+    // the name of the pool, for logging
+    const char* name;
+
+    // the workers
+    worker_t* workers;
+    int count;
+
+    // the worker to give the next job to
+    atomic_uint next_worker;
+} worker_pool_t;
+
+/**
+ * Start the workers of the pool
+ *
+ * @param pool      [IN] The pool
+ * @param name      [IN] The name of the pool
+ * @param count     [IN] The amount of workers
+ */
+err_t init_worker_pool(worker_pool_t* pool, const char* name, int count);
+
+/**
+ * The total time all the workers spent running jobs, in nanoseconds
+ *
+ * @param pool      [IN] The pool
+ */
+uint64_t worker_pool_busy_ns(worker_pool_t* pool);
+
+/**
+ * Hand a job to one of the workers, this only fills an sqe on the ring of the
+ * caller. Once the job is done the worker posts a cqe with the reply data and
+ * a res of 0 to the reply ring. If the job could not be handed to the worker
+ * the caller gets a cqe with the reply data and a negative res on its own ring,
+ * in which case it should run the job itself
+ *
+ * @param pool  [IN] The pool, must have at least one worker
+ * @param sqe   [IN] An sqe of the ring of the caller
+ * @param job   [IN] The job, must stay alive until it is done
+ */
+void worker_pool_submit(worker_pool_t* pool, struct io_uring_sqe* sqe, worker_job_t* job);
@@ -0,0 +1,57 @@
+#include "spsc_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+err_t init_spsc_queue(spsc_queue_t* queue, size_t capacity, size_t entry_size) {
+    err_t err = NO_ERROR;
+
+    CHECK(capacity != 0 && (capacity & (capacity - 1)) == 0, "queue capacity must be a power of two (got %zu)", capacity);
+
+    queue->entries = calloc(capacity, entry_size);
+    CHECK_ERRNO(queue->entries != NULL);
+    queue->entry_size = entry_size;
+    queue->mask = capacity - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->cached_head = 0;
+    queue->cached_tail = 0;
+
+cleanup:
+    return err;
+}
+
+bool spsc_queue_push(spsc_queue_t* queue, const void* entry) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (tail - queue->cached_head > queue->mask) {
+        // looks full, see how far the consumer got
+        queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail - queue->cached_head > queue->mask) {
+            return false;
+        }
+    }
+
+    memcpy(queue->entries + (tail & queue->mask) * queue->entry_size, entry, queue->entry_size);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_queue_pop(spsc_queue_t* queue, void* entry) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head == queue->cached_tail) {
+        // looks empty, see how far the producer got
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head == queue->cached_tail) {
+            return false;
+        }
+    }
+
+    memcpy(entry, queue->entries + (head & queue->mask) * queue->entry_size, queue->entry_size);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+size_t spsc_queue_count(spsc_queue_t* queue) {
+    queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    return queue->cached_tail - atomic_load_explicit(&queue->head, memory_order_relaxed);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <lib/except.h>
+
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A bounded queue between a single producer thread and a single consumer thread,
+ * without any locks. The entries are copied in and out of the queue by value.
+ *
+ * Each side keeps a cached copy of the position of the other side, so it only
+ * touches the cache line of the other side once it looks full (or empty)
+ */
+typedef struct spsc_queue {
+    // the producer side, the next entry to write
+    alignas(64) atomic_size_t tail;
+    size_t cached_head;
+
+    // the consumer side, the next entry to read
+    alignas(64) atomic_size_t head;
+    size_t cached_tail;
+
+    // the entries, never written after init
+    alignas(64) uint8_t* entries;
+    size_t entry_size;
+    size_t mask;
+} spsc_queue_t;
+
+/**
+ * Allocate the entries of the queue
+ *
+ * @param queue         [IN] The queue
+ * @param capacity      [IN] The amount of entries, must be a power of two
+ * @param entry_size    [IN] The size of a single entry
+ */
+err_t init_spsc_queue(spsc_queue_t* queue, size_t capacity, size_t entry_size);
+
+/**
+ * Push an entry to the queue, only called from the producer
+ *
+ * @param queue     [IN] The queue
+ * @param entry     [IN] The entry to copy in
+ *
+ * @return false if the queue is full
+ */
+bool spsc_queue_push(spsc_queue_t* queue, const void* entry);
+
+/**
+ * Pop an entry from the queue, only called from the consumer
+ *
+ * @param queue     [IN]    The queue
+ * @param entry     [OUT]   The entry to copy out to
+ *
+ * @return false if the queue is empty
+ */
+bool spsc_queue_pop(spsc_queue_t* queue, void* entry);
+
+/**
+ * The amount of entries in the queue, only called from the consumer. The producer
+ * may push more right after, so this is the least amount that can be popped
+ *
+ * @param queue     [IN] The queue
+ */
+size_t spsc_queue_count(spsc_queue_t* queue);